@@ -0,0 +1,104 @@
+/**
+ * @file dns_tools.bpf.h
+ * @brief Map layouts and QNAME hash shared by BPF programs and loaders
+ *
+ * Included by the BPF programs (clang -target bpf) and by their userspace
+ * loaders. Layouts and constants mirror dns_tools.h, loaders check that at
+ * compile time, so hot table entries are copied into maps as is and both
+ * sides compute the very same QNAME hash.
+ */
+
+#pragma once
+
+#include <linux/types.h>
+
+/** DNS port served by the BPF programs (DNS_PORT) */
+#define DNS_BPF_PORT 53u
+
+/** FNV-1a offset basis and prime (DNS_HASH_BASIS, DNS_HASH_PRIME) */
+#define DNS_BPF_HASH_BASIS 2166136261u
+#define DNS_BPF_HASH_PRIME 16777619u
+
+/** Maximum QNAME wire length (DNS_QNAME_WIRE_MAX) */
+#define DNS_BPF_NAME_MAX 65u
+
+/** Maximum precompiled answer RR length (DNS_HOT_RR_MAX) */
+#define DNS_BPF_RR_MAX 28u
+
+/** Maximum number of hot records in XDP map */
+#define DNS_BPF_HOT_MAX 1024u
+
+/** Maximum number of reuseport workers */
+#define DNS_BPF_WORKERS_MAX 256u
+
+/** Maximum number of CPUs in CPU to worker map (DNS_CPU_MAP_MAX) */
+#define DNS_BPF_CPU_MAX 256u
+
+/** XDP counters (per CPU array indices) */
+#define DNS_BPF_STAT_ANSWERED 0u /**< Answered in the driver hook */
+#define DNS_BPF_STAT_PASSED   1u /**< DNS queries passed to userspace */
+#define DNS_BPF_STATS         2u
+
+/** Hot record map key */
+struct dns_bpf_hot_key {
+	__u32 hash;      /**< `dns_name_hash` of QNAME */
+	__u16 type;      /**< Record type */
+	__u16 _reserved; /**< Zero */
+};
+
+/** Hot record map value, same layout as `struct dns_hot_entry` */
+struct dns_bpf_hot_entry {
+	__u32 hash;     /**< `dns_name_hash` of the name */
+	__u16 type;     /**< Record type */
+	__u8  name_len; /**< Wire name length */
+	__u8  rr_len;   /**< Precompiled answer RR length */
+
+	__u8 name[DNS_BPF_NAME_MAX]; /**< Lowercase wire name */
+	__u8 rr[DNS_BPF_RR_MAX];     /**< Precompiled answer RR */
+};
+
+#ifdef __bpf__
+/** Copies QNAME at `p` (bytes up to `end`) lower cased into `name` and
+ *  hashes it like `dns_name_hash`. Returns wire name length, 0 if QNAME is
+ *  invalid, compressed or longer than DNS_BPF_NAME_MAX */
+static __always_inline __u32 dns_bpf_qname(const __u8 *p, const void *end,
+					   __u8 *name, __u32 *hash)
+{
+	__u32 h = DNS_BPF_HASH_BASIS;
+	__u32 label = 0u; /* Offset of next label length byte */
+	__u32 len = 0u;
+	__u32 i;
+	int   ok = 1;
+
+	for (i = 0u; ok && (len == 0u) && (i < DNS_BPF_NAME_MAX); i++) {
+		__u8 c;
+
+		if ((const void *)(p + i + 1u) > end) {
+			ok = 0;
+		} else {
+			c = p[i];
+
+			if (i != label) {
+				/* Label byte */
+			} else if (c == 0u) {
+				len = i + 1u; /* Root label */
+			} else if (c > 63u) {
+				ok = 0; /* Compression pointer */
+			} else {
+				label = i + 1u + c;
+			}
+
+			if ((c >= 'A') && (c <= 'Z')) {
+				c = (__u8)(c + 0x20u);
+			}
+
+			name[i] = c;
+			h = (h ^ c) * DNS_BPF_HASH_PRIME;
+		}
+	}
+
+	*hash = h;
+
+	return ok ? len : 0u;
+}
+#endif
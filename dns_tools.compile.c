@@ -0,0 +1,293 @@
+/**
+ * @file dns_tools.compile.c
+ * @brief Block list compiler: text lists into a mappable suffix tree image
+ *
+ * Reads hosts files, domain lists and adblock `||domain^` rules
+ * (`dns_list_parse_line`), dedupes names in a suffix tree and writes its
+ * binary image (`dns_suffix_tree_save`). The query path maps the image
+ * (mmap) and checks it with `dns_suffix_tree_load`, nothing is parsed at
+ * startup. Node value of every name is the number (from 0) of the last
+ * list it came from. Node and label storage start small and are doubled
+ * until every list fits, then the tree is rebuilt into the smallest node
+ * capacity it fits, as the image carries empty slots too. The image is
+ * written next to the output and renamed over it, so a running server
+ * never maps a half written file.
+ * Build: `make compiler`. Usage:
+ *
+ * ```
+ * ./dns_compile blocklist.img hosts.txt easylist.txt domains.txt
+ * ```
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dns_tools.h"
+
+/** Longest list line handled, longer lines are skipped */
+#define DNS_COMPILE_LINE_MAX 4096u
+
+/** Initial storage, doubled while lists don't fit */
+#define DNS_COMPILE_NODES  4096u
+#define DNS_COMPILE_LABELS 65536u
+
+/** Storage limits (image of about 26 GiB) */
+#define DNS_COMPILE_NODES_MAX  0x40000000u
+#define DNS_COMPILE_LABELS_MAX 0x80000000u
+
+/** Number of skipped overlong lines */
+static unsigned long dns_compile_overlong;
+
+/** Adds every name of list `f` into tree with value `value`. Returns
+ *  number of names read */
+static unsigned long dns_compile_list(struct dns_suffix_tree *tree, FILE *f,
+				      uint32_t value)
+{
+	char     line[DNS_COMPILE_LINE_MAX];
+	uint8_t  wire[DNS_NAME_WIRE_MAX];
+	unsigned long result = 0u;
+	size_t   len;
+	size_t   pos;
+	size_t   name_len;
+	bool     overlong;
+	bool     skip = false; /* Rest of an overlong line */
+
+	while ((tree->malformed == 0u) &&
+	       (fgets(line, (int)sizeof(line), f) != NULL)) {
+		len = strlen(line);
+		overlong = ((len == 0u) || (line[len - 1u] != '\n')) &&
+			   (feof(f) == 0);
+
+		if (overlong && !skip) {
+			dns_compile_overlong++;
+		}
+
+		pos = 0u;
+		name_len = (skip || overlong) ? 0u : 1u;
+
+		while ((name_len > 0u) && (tree->malformed == 0u)) {
+			name_len = dns_list_parse_line(line, len, &pos, wire,
+						       sizeof(wire));
+
+			if (name_len > 0u) {
+				(void)dns_suffix_tree_insert(tree, wire,
+							     name_len, value);
+				result++;
+			}
+		}
+
+		skip = overlong;
+	}
+
+	return result;
+}
+
+/** Compiles `count` lists at `path` into tree. Returns number of names
+ *  read, -1 if a list can't be read. Tree is malformed if it got full */
+static long dns_compile_lists(struct dns_suffix_tree *tree, char **path,
+			      int count)
+{
+	long  result = 0;
+	FILE *f;
+	int   i;
+
+	dns_compile_overlong = 0u;
+
+	for (i = 0; (result >= 0) && (tree->malformed == 0u) && (i < count);
+	     i++) {
+		f = fopen(path[i], "r");
+
+		if (f == NULL) {
+			fprintf(stderr, "can't read %s\n", path[i]);
+			result = -1;
+		} else {
+			result += (long)dns_compile_list(tree, f, (uint32_t)i);
+
+			if (ferror(f) != 0) {
+				fprintf(stderr, "can't read %s\n", path[i]);
+				result = -1;
+			}
+
+			(void)fclose(f);
+		}
+	}
+
+	return result;
+}
+
+/** Rebuilds `src` into `dst` with the smallest node capacity keeping 1/8
+ *  of slots free (like `dns_suffix_tree_insert`) and exact label pool.
+ *  Storage is allocated into `nodes` and `labels`, caller frees it.
+ *  Returns true on success */
+static bool dns_compile_fit(const struct dns_suffix_tree *src,
+			    struct dns_suffix_tree *dst,
+			    struct dns_suffix_node **nodes, uint8_t **labels)
+{
+	uint8_t  name[DNS_NAME_WIRE_MAX];
+	uint32_t cap = 1u;
+	uint32_t labels_cap = (src->labels_len > 0u) ? src->labels_len : 1u;
+	uint32_t node = DNS_INDEX_NONE;
+	size_t   len;
+	bool     ok;
+
+	/* Terminates at src->_cap at the latest */
+	while (src->len > (cap - (cap / 8u))) {
+		cap *= 2u;
+	}
+
+	*nodes  = malloc((size_t)cap * sizeof(**nodes));
+	*labels = malloc(labels_cap);
+	ok      = (*nodes != NULL) && (*labels != NULL);
+
+	if (ok) {
+		dns_suffix_tree_init(dst, *nodes, cap, *labels, labels_cap);
+		node = dns_suffix_tree_next(src, DNS_SUFFIX_ROOT,
+					    DNS_SUFFIX_ROOT);
+	}
+
+	while ((node != DNS_INDEX_NONE) && (dst->malformed == 0u)) {
+		if ((src->_nodes[node].flags & DNS_SUFFIX_TERM) != 0u) {
+			len = dns_suffix_tree_name(src, node, name,
+						   sizeof(name));
+			(void)dns_suffix_tree_insert(dst, name, len,
+						     src->_nodes[node].value);
+		}
+
+		node = dns_suffix_tree_next(src, DNS_SUFFIX_ROOT, node);
+	}
+
+	return ok && (dst->malformed == 0u);
+}
+
+/** Writes image to `path` through a temporary file. Returns true on
+ *  success */
+static bool dns_compile_write(const char *path, const uint8_t *image,
+			      size_t len)
+{
+	char *tmp = malloc(strlen(path) + 5u);
+	FILE *f = NULL;
+	bool  ok = (tmp != NULL);
+
+	if (ok) {
+		(void)strcpy(tmp, path);
+		(void)strcat(tmp, ".tmp");
+
+		f  = fopen(tmp, "wb");
+		ok = (f != NULL);
+	}
+
+	if (ok) {
+		ok = (fwrite(image, 1u, len, f) == len);
+		ok = (fclose(f) == 0) && ok;
+		ok = ok && (rename(tmp, path) == 0);
+
+		if (!ok) {
+			(void)remove(tmp);
+		}
+	}
+
+	free(tmp);
+
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	struct dns_suffix_tree tree;
+	struct dns_suffix_tree fit;
+	struct dns_suffix_node *nodes = NULL;
+	struct dns_suffix_node *fit_nodes = NULL;
+	uint8_t *labels = NULL;
+	uint8_t *fit_labels = NULL;
+	uint8_t *image = NULL;
+	uint32_t cap = DNS_COMPILE_NODES;
+	uint32_t labels_cap = DNS_COMPILE_LABELS;
+	size_t   image_len = 0u;
+	long     names = 0;
+	bool     grow = false;
+	bool     ok = (argc >= 3);
+
+	if (!ok) {
+		fprintf(stderr, "usage: %s <image> <list>...\n", argv[0]);
+	}
+
+	/* Compile from scratch into twice the storage until lists fit */
+	do {
+		free(nodes);
+		free(labels);
+
+		nodes  = malloc((size_t)cap * sizeof(*nodes));
+		labels = malloc(labels_cap);
+		ok     = ok && (nodes != NULL) && (labels != NULL);
+
+		if (ok) {
+			dns_suffix_tree_init(&tree, nodes, cap, labels,
+					     labels_cap);
+			names = dns_compile_lists(&tree, &argv[2], argc - 2);
+			ok    = (names >= 0);
+		}
+
+		grow = ok && (tree.malformed != 0u);
+
+		if (!grow) {
+			/* Done or failed */
+		} else if ((labels_cap - tree.labels_len) < 64u) {
+			grow = (labels_cap < DNS_COMPILE_LABELS_MAX);
+			labels_cap = grow ? (labels_cap * 2u) : labels_cap;
+		} else if (tree.len >= (cap - (cap / 8u))) {
+			grow = (cap < DNS_COMPILE_NODES_MAX);
+			cap  = grow ? (cap * 2u) : cap;
+		} else {
+			grow = false; /* Not full, name refused */
+		}
+	} while (grow);
+
+	if (ok && (tree.malformed != 0u)) {
+		fprintf(stderr, "lists don't fit into %lu nodes and %lu label "
+				"bytes\n", (unsigned long)cap,
+			(unsigned long)labels_cap);
+		ok = false;
+	}
+
+	/* Empty slots beyond the load factor would bloat the image */
+	if (ok) {
+		ok = dns_compile_fit(&tree, &fit, &fit_nodes, &fit_labels);
+
+		if (!ok) {
+			fprintf(stderr, "can't rebuild compiled lists\n");
+		}
+	}
+
+	if (ok) {
+		image_len = dns_suffix_tree_image_size(&fit);
+		image     = malloc(image_len);
+		ok        = (image != NULL) &&
+			    (dns_suffix_tree_save(&fit, image, image_len) ==
+			     image_len) &&
+			    dns_compile_write(argv[1], image, image_len);
+
+		if (!ok) {
+			fprintf(stderr, "can't write %s\n", argv[1]);
+		}
+	}
+
+	if (ok) {
+		printf("%ld names, %lu of %lu nodes, %lu label bytes: "
+		       "%lu byte image\n", names, (unsigned long)fit.len,
+		       (unsigned long)fit._cap, (unsigned long)fit.labels_len,
+		       (unsigned long)image_len);
+
+		if (dns_compile_overlong > 0u) {
+			printf("%lu overlong lines skipped\n",
+			       dns_compile_overlong);
+		}
+	}
+
+	free(image);
+	free(nodes);
+	free(labels);
+	free(fit_nodes);
+	free(fit_labels);
+
+	return ok ? 0 : 1;
+}
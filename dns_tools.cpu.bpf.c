@@ -0,0 +1,80 @@
+/**
+ * @file dns_tools.cpu.bpf.c
+ * @brief SO_ATTACH_REUSEPORT_EBPF selector steering queries by receiving CPU
+ *
+ * Every worker owns one UDP socket of the same SO_REUSEPORT group and is
+ * pinned to the IRQ CPU of it's RX queue. The selector picks the worker of
+ * the CPU that received the packet, exactly like `dns_cpu_map_select`, so
+ * a query never crosses cores between the driver and the worker. CPUs
+ * without RX queue are spread over workers. Loaded by `dns_cpu_attach`
+ * (dns_tools.cpu.c) from a `struct dns_cpu_map`.
+ *
+ * A reuseport group runs a single program: attach either this one or the
+ * QNAME hash selector (dns_tools.reuseport.bpf.c), not both.
+ *
+ * Build: `make bpf` (clang -O2 -g -target bpf)
+ */
+
+#include <linux/bpf.h>
+#include <bpf/bpf_helpers.h>
+
+#include "dns_tools.bpf.h"
+
+/** Worker sockets, index is worker number */
+struct {
+	__uint(type, BPF_MAP_TYPE_REUSEPORT_SOCKARRAY);
+	__uint(max_entries, DNS_BPF_WORKERS_MAX);
+	__type(key, __u32);
+	__type(value, __u32);
+} dns_cpu_sockets SEC(".maps");
+
+/** Worker serving packets received on CPU (`cpu_worker` of the map),
+ *  index is CPU number, unmapped CPUs hold a number >= workers */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, DNS_BPF_CPU_MAX);
+	__type(key, __u32);
+	__type(value, __u32);
+} dns_cpu_workers SEC(".maps");
+
+/** Number of workers (single entry) */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1u);
+	__type(key, __u32);
+	__type(value, __u32);
+} dns_cpu_worker_count SEC(".maps");
+
+SEC("sk_reuseport")
+int dns_cpu_select(struct sk_reuseport_md *ctx)
+{
+	__u32 cpu = bpf_get_smp_processor_id();
+	__u32 zero = 0u;
+	__u32 *workers;
+	__u32 *worker = NULL;
+	__u32 index;
+
+	workers = bpf_map_lookup_elem(&dns_cpu_worker_count, &zero);
+
+	if ((workers == NULL) || (*workers == 0u) ||
+	    (*workers > DNS_BPF_WORKERS_MAX)) {
+		return SK_PASS;
+	}
+
+	if (cpu < DNS_BPF_CPU_MAX) {
+		worker = bpf_map_lookup_elem(&dns_cpu_workers, &cpu);
+	}
+
+	/* Like `dns_cpu_map_select` */
+	if ((worker != NULL) && (*worker < *workers)) {
+		index = *worker;
+	} else {
+		index = cpu % *workers;
+	}
+
+	(void)bpf_sk_select_reuseport(ctx, &dns_cpu_sockets, &index, 0u);
+
+	return SK_PASS;
+}
+
+char _license[] SEC("license") = "Dual BSD/GPL";
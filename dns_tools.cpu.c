@@ -0,0 +1,260 @@
+/**
+ * @file dns_tools.cpu.c
+ * @brief RX queue discovery and CPU affinity of workers (binding layer)
+ *
+ * Fills a `struct dns_cpu_map` from the NIC RX queue interrupts of an
+ * interface, then keeps every packet on the core that received it, either
+ * way:
+ * - `dns_cpu_bind_worker` pins each worker thread to it's CPU and sets
+ *   SO_INCOMING_CPU of it's socket, the kernel then prefers that socket of
+ *   the SO_REUSEPORT group for packets received on the CPU;
+ * - `dns_cpu_attach` loads the CPU keyed selector
+ *   (dns_tools.cpu.bpf.c) onto the group (workers still pinned).
+ *
+ * Interfaces without per queue interrupts (loopback, veth) get a simulated
+ * mapping, one queue per CPU, which works the same way. Linux only, the
+ * selector needs libbpf 1.0 or newer. Build: `make bpf`.
+ */
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "dns_tools.h"
+#include "dns_tools.bpf.h"
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+
+#ifndef SO_ATTACH_REUSEPORT_EBPF
+#define SO_ATTACH_REUSEPORT_EBPF 52
+#endif
+
+/** Longest /proc/interrupts line handled (one column per CPU) */
+#define DNS_CPU_LINE_MAX 8192u
+
+/* BPF program must select exactly like dns_tools.h */
+typedef char dns_cpu_layout_check[
+	((DNS_BPF_CPU_MAX == DNS_CPU_MAP_MAX) &&
+	 (DNS_BPF_WORKERS_MAX >= DNS_CPU_MAP_MAX)) ? 1 : -1];
+
+/** Returns first CPU of interrupt `irq` affinity, -1 if unknown */
+static int dns_cpu_irq_cpu(unsigned int irq)
+{
+	static const char *const files[] = {
+		"effective_affinity_list", "smp_affinity_list"
+	};
+	char path[64];
+	FILE *f;
+	int  cpu = -1;
+	unsigned int i;
+
+	for (i = 0u; (cpu < 0) && (i < 2u); i++) {
+		(void)snprintf(path, sizeof(path), "/proc/irq/%u/%s", irq,
+			       files[i]);
+		f = fopen(path, "r");
+
+		if (f != NULL) {
+			/* "2", "0-3" or "1,5": first CPU is enough */
+			if (fscanf(f, "%d", &cpu) != 1) {
+				cpu = -1;
+			}
+
+			(void)fclose(f);
+		}
+	}
+
+	return cpu;
+}
+
+/** Returns interrupt number of /proc/interrupts `line` if it belongs to a
+ *  receive queue of `ifname` ("eth0-TxRx-0", "eth0-rx-1"; not
+ *  "eth0-tx-0"), -1 otherwise */
+static long dns_cpu_queue_irq(char *line, const char *ifname)
+{
+	size_t len = strlen(line);
+	size_t ifname_len = strlen(ifname);
+	char  *name;
+	char  *end;
+	long   irq = strtol(line, &end, 10);
+
+	while ((len > 0u) && ((line[len - 1u] == '\n') ||
+	       (line[len - 1u] == ' '))) {
+		len--;
+	}
+
+	line[len] = '\0';
+	name = strrchr(line, ' ');
+	name = (name != NULL) ? (name + 1) : line;
+
+	if ((end == line) || (*end != ':') ||
+	    (strncmp(name, ifname, ifname_len) != 0) ||
+	    (name[ifname_len] != '-') ||
+	    (strstr(&name[ifname_len], "-tx-") != NULL)) {
+		irq = -1;
+	}
+
+	return irq;
+}
+
+/** Initializes `map` with receive queues of interface `ifname`, found in
+ *  /proc/interrupts in queue order, each served by the first CPU of it's
+ *  interrupt affinity. Queues sharing a CPU are served by one worker. If
+ *  no queue is found, `simulate` queues are mapped onto CPUs 0, 1, ...
+ *  (0 means one per online CPU). Returns number of workers, -1 on error */
+int dns_cpu_discover(struct dns_cpu_map *map, const char *ifname,
+		     uint16_t simulate)
+{
+	char line[DNS_CPU_LINE_MAX];
+	FILE *f = fopen("/proc/interrupts", "r");
+	long  irq;
+	long  online;
+	int   cpu;
+	uint16_t i;
+
+	dns_cpu_map_init(map);
+
+	while ((f != NULL) && (map->malformed == 0u) &&
+	       (fgets(line, (int)sizeof(line), f) != NULL)) {
+		irq = dns_cpu_queue_irq(line, ifname);
+		cpu = (irq >= 0) ? dns_cpu_irq_cpu((unsigned int)irq) : -1;
+
+		if ((cpu >= 0) && (cpu < (int)DNS_CPU_MAP_MAX) &&
+		    (map->cpu_worker[cpu] == DNS_CPU_NONE)) {
+			(void)dns_cpu_map_add_queue(map, (uint16_t)cpu);
+		}
+	}
+
+	if (f != NULL) {
+		(void)fclose(f);
+	}
+
+	/* Simulated mapping */
+	if (map->workers == 0u) {
+		online = sysconf(_SC_NPROCESSORS_ONLN);
+
+		if (simulate == 0u) {
+			simulate = (online > 0) ? (uint16_t)online : 1u;
+		}
+
+		if (simulate > DNS_CPU_MAP_MAX) {
+			simulate = DNS_CPU_MAP_MAX;
+		}
+
+		for (i = 0u; i < simulate; i++) {
+			(void)dns_cpu_map_add_queue(map, i);
+		}
+	}
+
+	return (map->malformed == 0u) ? (int)map->workers : -1;
+}
+
+/** Pins calling thread to the CPU of `worker` and sets SO_INCOMING_CPU of
+ *  it's socket `fd`. Call from the worker thread. Returns true on
+ *  success */
+bool dns_cpu_bind_worker(const struct dns_cpu_map *map, uint16_t worker,
+			 int fd)
+{
+	uint16_t  cpu = dns_cpu_map_worker_cpu(map, worker);
+	int       cpu_opt = (int)cpu;
+	cpu_set_t set;
+	bool      ok = (cpu != DNS_CPU_NONE);
+
+	if (ok) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+
+		ok = (sched_setaffinity(0, sizeof(set), &set) == 0);
+	}
+
+	if (ok) {
+		ok = (setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu_opt,
+				 sizeof(cpu_opt)) == 0);
+	}
+
+	return ok;
+}
+
+/** Loads CPU keyed selector object at `path` and attaches it to the group
+ *  of `map->workers` sockets `fds` (UDP sockets, one per worker in worker
+ *  order, already bound to the same address with SO_REUSEPORT). Returns
+ *  loaded object, keep it while sockets are open and release with
+ *  `bpf_object__close`. Returns NULL on error */
+struct bpf_object *dns_cpu_attach(const char *path,
+				  const struct dns_cpu_map *map,
+				  const int *fds)
+{
+	struct bpf_object  *obj = NULL;
+	struct bpf_program *prog = NULL;
+	int      sock_map = -1;
+	int      cpu_map = -1;
+	int      count_map = -1;
+	int      prog_fd = -1;
+	uint32_t workers = map->workers;
+	uint32_t zero = 0u;
+	uint32_t value;
+	uint32_t i;
+	bool     ok = (fds != NULL) && (map->malformed == 0u) &&
+		      (workers > 0u) && (workers <= DNS_BPF_WORKERS_MAX);
+
+	if (ok) {
+		obj = bpf_object__open_file(path, NULL);
+		ok  = (obj != NULL) && (bpf_object__load(obj) == 0);
+	}
+
+	if (ok) {
+		prog      = bpf_object__find_program_by_name(obj,
+						"dns_cpu_select");
+		sock_map  = bpf_object__find_map_fd_by_name(obj,
+						"dns_cpu_sockets");
+		cpu_map   = bpf_object__find_map_fd_by_name(obj,
+						"dns_cpu_workers");
+		count_map = bpf_object__find_map_fd_by_name(obj,
+						"dns_cpu_worker_count");
+
+		ok = (prog != NULL) && (sock_map >= 0) && (cpu_map >= 0) &&
+		     (count_map >= 0);
+	}
+
+	if (ok) {
+		prog_fd = bpf_program__fd(prog);
+		ok = (prog_fd >= 0);
+	}
+
+	for (i = 0u; ok && (i < workers); i++) {
+		value = (uint32_t)fds[i];
+		ok = (bpf_map_update_elem(sock_map, &i, &value, BPF_ANY) == 0);
+	}
+
+	/* DNS_CPU_NONE is beyond any worker, selector spreads such CPUs */
+	for (i = 0u; ok && (i < DNS_CPU_MAP_MAX); i++) {
+		value = map->cpu_worker[i];
+		ok = (bpf_map_update_elem(cpu_map, &i, &value, BPF_ANY) == 0);
+	}
+
+	if (ok) {
+		ok = (bpf_map_update_elem(count_map, &zero, &workers,
+					  BPF_ANY) == 0);
+	}
+
+	/* Program is shared by the whole group, attach via any socket */
+	if (ok) {
+		ok = (setsockopt(fds[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_EBPF,
+				 &prog_fd, sizeof(prog_fd)) == 0);
+	}
+
+	if (!ok && (obj != NULL)) {
+		bpf_object__close(obj);
+		obj = NULL;
+	}
+
+	return obj;
+}
@@ -0,0 +1,93 @@
+# Worst case stack depth of the embedded footprint profile.
+#
+# Reads GCC call graph (-fcallgraph-info=su, VCG format) and prints the
+# deepest call chain, summing frames of every function on the chain,
+# starting from any function nobody calls (the entry points). Calls into
+# functions without stack information (library) count as 0 bytes and are
+# reported. Recursion or dynamic stack make the budget unbounded: error.
+
+# Returns value of `key: "..."` attribute of VCG line
+function attr(line, key,   s)
+{
+	s = line
+	if (!sub(".*" key ": \"", "", s))
+		return ""
+	sub("\".*", "", s)
+	return s
+}
+
+# Returns stack of the deepest chain starting at `t`, remembers next hop
+function depth(t, level,   list, n, i, d, best, hop)
+{
+	if (t in memo)
+		return memo[t]
+	if (level > 64) {
+		recursive = 1
+		return 0
+	}
+
+	best = 0
+	hop = ""
+	n = split(calls[t], list, SUBSEP)
+	for (i = 2; i <= n; i++) {
+		d = depth(list[i], level + 1)
+		if ((d > best) || (hop == "")) {
+			best = d
+			hop = list[i]
+		}
+	}
+
+	memo[t] = frame[t] + best
+	next_hop[t] = hop
+	return memo[t]
+}
+
+/^node:/ {
+	t = attr($0, "title")
+	n = split(attr($0, "label"), part, /\\n/)
+	name[t] = part[1]
+	frame[t] = part[3] + 0
+	if (part[3] ~ /dynamic/ && part[3] !~ /bounded/)
+		dynamic = dynamic " " part[1]
+}
+
+/^edge:/ {
+	src = attr($0, "sourcename")
+	dst = attr($0, "targetname")
+	calls[src] = calls[src] SUBSEP dst
+	called[dst] = 1
+}
+
+END {
+	worst = 0
+	root = ""
+	for (t in name) {
+		if (!(t in called)) {
+			d = depth(t, 0)
+			if ((d > worst) || (root == "")) {
+				worst = d
+				root = t
+			}
+		}
+	}
+
+	chain = ""
+	extern = ""
+	for (t = root; t != ""; t = next_hop[t]) {
+		if (t in name) {
+			chain = chain ((chain == "") ? "" : " -> ") name[t]
+		} else {
+			chain = chain " -> " t
+			extern = extern " " t
+		}
+	}
+
+	printf "Stack: %d bytes (worst call chain %s)\n", worst, chain
+	if (extern != "")
+		printf "Note: library calls not included:%s\n", extern
+	if (recursive || (dynamic != "")) {
+		printf "Error: unbounded stack (recursion or dynamic%s)\n", \
+		    dynamic
+		exit 1
+	}
+}
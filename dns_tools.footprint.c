@@ -0,0 +1,109 @@
+/**
+ * @file dns_tools.footprint.c
+ * @brief Embedded footprint profile of the DNS server path
+ *
+ * Minimal server path for microcontrollers: parse query, minimise ANY,
+ * answer hot records, refuse the rest. With DNS_FOOTPRINT_CAPTIVE defined
+ * it is a captive portal responder instead (every A/AAAA answered with
+ * portal address). Every table is statically sized at compile time
+ * (override the DNS_FOOTPRINT_* macros), nothing is allocated.
+ * `make footprint` builds both variants, links them with section GC and
+ * reports flash, RAM and worst call chain stack (dns_tools.footprint.awk
+ * over the GCC call graph). Cross compile with, for example:
+ *
+ * ```
+ * make footprint FOOTPRINT_CC=arm-none-eabi-gcc \
+ *                FOOTPRINT_SIZE=arm-none-eabi-size \
+ *                FOOTPRINT_NM=arm-none-eabi-nm \
+ *                FOOTPRINT_ARCH=-mcpu=cortex-m0
+ * ```
+ *
+ * The binding layer owns the network interface: it receives UDP payload
+ * into `dns_footprint_packet`, calls `dns_footprint_serve` and sends back
+ * the returned number of bytes.
+ */
+
+#include "dns_tools.h"
+
+/** Maximum UDP payload (query and answer) */
+#ifndef DNS_FOOTPRINT_PACKET_SIZE
+#define DNS_FOOTPRINT_PACKET_SIZE 512u
+#endif
+
+/** Number of hot record slots (power of two) */
+#ifndef DNS_FOOTPRINT_HOT_RECORDS
+#define DNS_FOOTPRINT_HOT_RECORDS 16u
+#endif
+
+static uint8_t dns_footprint_buf[DNS_FOOTPRINT_PACKET_SIZE];
+
+#ifdef DNS_FOOTPRINT_CAPTIVE
+static struct dns_captive dns_footprint_captive;
+
+/** Initializes captive responder with portal addresses (either may be
+ *  NULL) */
+void dns_footprint_init(const uint8_t *ipv4, const uint8_t *ipv6,
+			uint32_t ttl_s)
+{
+	dns_captive_init(&dns_footprint_captive, ipv4, ipv6, ttl_s);
+}
+#else
+static struct dns_hot_entry dns_footprint_hot_entries[
+	DNS_FOOTPRINT_HOT_RECORDS];
+static struct dns_hot_table dns_footprint_hot;
+
+/** Initializes server tables */
+void dns_footprint_init(void)
+{
+	dns_hot_init(&dns_footprint_hot, dns_footprint_hot_entries,
+		     DNS_FOOTPRINT_HOT_RECORDS);
+}
+
+/** Adds static record. `name` is dotted name. Returns true on success */
+bool dns_footprint_add(const char *name, uint16_t type, uint32_t ttl_s,
+		       const uint8_t *rdata, uint16_t rdlen)
+{
+	uint8_t wire[DNS_QNAME_WIRE_MAX];
+	size_t  len = dns_name_from_str(name, wire, sizeof(wire));
+
+	return (len > 0u) && dns_hot_add(&dns_footprint_hot, wire, len, type,
+					 ttl_s, rdata, rdlen);
+}
+#endif
+
+/** Returns packet buffer (receive query here) */
+uint8_t *dns_footprint_packet(void)
+{
+	return dns_footprint_buf;
+}
+
+/** Serves query of `len` bytes in packet buffer. Returns answer length,
+ *  0 if nothing should be sent */
+size_t dns_footprint_serve(size_t len)
+{
+	struct dns_msg msg;
+	size_t answer_len = 0u;
+
+	dns_msg_init(&msg, dns_footprint_buf, sizeof(dns_footprint_buf));
+	dns_msg_parse_query(&msg, len);
+
+	if (msg.malformed == 0u) {
+		answer_len = dns_msg_answer_any(&msg);
+	}
+
+#ifdef DNS_FOOTPRINT_CAPTIVE
+	if ((msg.malformed == 0u) && (answer_len == 0u)) {
+		answer_len = dns_captive_answer(&dns_footprint_captive, &msg);
+	}
+#else
+	if ((msg.malformed == 0u) && (answer_len == 0u)) {
+		answer_len = dns_hot_answer(&dns_footprint_hot, &msg);
+	}
+
+	if ((msg.malformed == 0u) && (answer_len == 0u)) {
+		answer_len = dns_msg_answer_rcode(&msg, DNS_RCODE_REFUSED);
+	}
+#endif
+
+	return answer_len;
+}
@@ -50,6 +50,13 @@ struct dns_msg {
 	char     name[64]; /**< Domain name string in aaa.bbb.ccc form */
 	uint8_t _name_len; /**< Length of domain name */
 
+	/** Length of domain name in wire format (starts at offset 12) */
+	uint8_t _qname_len;
+
+	/** Offsets of domain name labels (relative to offset 12) */
+	uint8_t _label_ofs[32];
+	uint8_t _label_count; /**< Number of labels (root excluded) */
+
 	uint16_t query_type;  /**< DNS query type */
 	uint16_t query_class; /**< DNS query class */
 
@@ -68,7 +75,10 @@ static void dns_msg_init(struct dns_msg *self, uint8_t *buf, size_t cap)
 
 	self->_ofs = 0u;
 
-	self->_name_len = 0u;
+	self->_name_len  = 0u;
+	self->_qname_len = 0u;
+
+	self->_label_count = 0u;
 
 	self->query_type  = 0u;
 	self->query_class = 0u;
@@ -101,11 +111,19 @@ static bool _dns_msg_parse_name_entry(struct dns_msg *self)
 	bool last_entry = (len == 0u);
 
 	if (((self->_ofs + len_full) > self->_packet_len) ||
-	    ((self->_name_len + len + 1u) > 64u)) {
+	    ((self->_name_len + len + 1u) > 64u) ||
+	    (!last_entry && (self->_label_count >= 32u))) {
 		self->malformed = __LINE__;
 	} else {		
 		uint8_t i;
 
+		/* Remember label boundary */
+		if (!last_entry) {
+			self->_label_ofs[self->_label_count] =
+				(uint8_t)(self->_ofs - 12u);
+			self->_label_count++;
+		}
+
 		self->_ofs += 1u; /* Skip len byte */
 
 		/* Append dot into name */
@@ -149,6 +167,10 @@ static void dns_msg_parse_query(struct dns_msg *self, size_t len)
 		while (_dns_msg_parse_name_entry(self) != true) {};
 	}
 
+	if (self->malformed == 0u) {
+		self->_qname_len = (uint8_t)(self->_ofs - 12u);
+	}
+
 	if (self->malformed == 0u) {
 		/* Parse query type and class */
 		if ((self->_ofs + 4u) > self->_packet_len) {
@@ -185,6 +207,12 @@ size_t dns_msg_add_answer(struct dns_msg *self, uint8_t *answer, size_t len)
 
 		self->_packet_buf[6] = 0;
 		self->_packet_buf[7] = 1; /* 1 Answer */
+
+		/* Answer overwrites anything after the question */
+		self->_packet_buf[8]  = 0;
+		self->_packet_buf[9]  = 0;
+		self->_packet_buf[10] = 0;
+		self->_packet_buf[11] = 0;
             
 		(void)memcpy(&self->_packet_buf[self->_ofs], answer, len);
         }
@@ -201,7 +229,5155 @@ static const char *dns_msg_get_type_str(struct dns_msg *self)
 		result = "AAAA (IPv6)";
 	} else if (self->query_type == 1u) {
 		result = "A (IPv4)";
+	} else if (self->query_type == 255u) {
+		result = "ANY";
+	} else {}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS STREAM (TCP / DoT)
+ *****************************************************************************/
+/** Well known DNS port (UDP and TCP) */
+#define DNS_PORT 53u
+
+/** Well known DNS-over-TLS port (RFC 7858) */
+#define DNS_PORT_DOT 853u
+
+/** Stream message framer for DNS over TCP and DNS over TLS (RFC 7766).
+ *  Every message on a stream is prefixed with 2 byte big endian length.
+ *
+ *  TLS itself (handshake, session tickets, resumption) lives in the binding
+ *  layer, so any TLS backend can be plugged in through `struct dns_tls_ops`
+ *  (see `struct dns_dot`), or fed by hand: decrypted bytes into the framer,
+ *  encrypt whatever it hands back. One framer per connection.
+ *  Connection is kept open between messages and queries may be pipelined,
+ *  so handshake cost is paid once per connection, not once per query.
+ *
+ *  The buffer keeps 2 bytes in front of the message, so the answer can be
+ *  framed in place without copying. */
+struct dns_stream {
+	uint8_t *_buf; /**< Reassembly buffer (length prefix + message) */
+	size_t   _cap; /**< Reassembly buffer capacity */
+	size_t   _len; /**< Bytes collected (length prefix included) */
+
+	/** Length of message being collected (from length prefix) */
+	uint16_t _msg_len;
+
+	/** Time since last received byte. Binding layer closes connection
+	 *  when it exceeds its idle timeout */
+	uint32_t idle_ms;
+
+	/** Number of messages framed on this connection */
+	uint32_t messages;
+
+	/** Set to __LINE__ if something is not right (close connection) */
+	uint32_t malformed;
+};
+
+/** Initializes stream framer. Takes reassembly buffer and it's capacity.
+ *  Capacity must include 2 bytes of the length prefix */
+static void dns_stream_init(struct dns_stream *self, uint8_t *buf, size_t cap)
+{
+	self->_buf = buf;
+	self->_cap = cap;
+	self->_len = 0u;
+
+	self->_msg_len = 0u;
+
+	self->idle_ms  = 0u;
+	self->messages = 0u;
+
+	self->malformed = 0u;
+
+	if ((buf == NULL) || (cap < 3u)) {
+		self->malformed = __LINE__;
+	}
+}
+
+/** Returns true if complete message is collected */
+static bool dns_stream_msg_ready(struct dns_stream *self)
+{
+	return (self->_len >= 2u) && (self->_len == (2u + self->_msg_len));
+}
+
+/** Feeds stream bytes into the framer. Returns number of bytes consumed.
+ *  Stops consuming as soon as complete message is collected, so pipelined
+ *  bytes stay in the caller buffer until `dns_stream_next` is called */
+static size_t dns_stream_write(struct dns_stream *self, const uint8_t *data,
+			       size_t len)
+{
+	size_t i = 0u;
+
+	if (len > 0u) {
+		self->idle_ms = 0u;
+	}
+
+	while ((i < len) && (self->malformed == 0u) &&
+	       !dns_stream_msg_ready(self)) {
+		self->_buf[self->_len] = data[i];
+		self->_len++;
+		i++;
+
+		if (self->_len == 2u) {
+			self->_msg_len = (uint16_t)(
+				((uint16_t)self->_buf[0] << 8) |
+				((uint16_t)self->_buf[1] << 0));
+
+			if ((self->_msg_len == 0u) ||
+			    ((2u + (size_t)self->_msg_len) > self->_cap)) {
+				self->malformed = __LINE__;
+			}
+		}
+
+		/* Count once, when the last byte of message is consumed */
+		if (dns_stream_msg_ready(self)) {
+			self->messages++;
+		}
+	}
+
+	return i;
+}
+
+/** Returns pointer to the collected message. Pass it to `dns_msg_init`
+ *  together with `dns_stream_msg_cap` */
+static uint8_t *dns_stream_msg(struct dns_stream *self)
+{
+	return &self->_buf[2];
+}
+
+/** Returns capacity available to the message and it's answer */
+static size_t dns_stream_msg_cap(struct dns_stream *self)
+{
+	return self->_cap - 2u;
+}
+
+/** Returns length of the collected message (for `dns_msg_parse_query`) */
+static size_t dns_stream_msg_len(struct dns_stream *self)
+{
+	return self->_msg_len;
+}
+
+/** Frames answer of `len` bytes in place. Returns number of bytes to send,
+ *  starting from the beginning of the reassembly buffer */
+static size_t dns_stream_frame(struct dns_stream *self, size_t len)
+{
+	size_t total_len = 0u;
+
+	if ((len == 0u) || (len > 0xFFFFu) || ((len + 2u) > self->_cap)) {
+		self->malformed = __LINE__;
+	} else {
+		self->_buf[0] = (uint8_t)(len >> 8);
+		self->_buf[1] = (uint8_t)(len >> 0);
+
+		total_len = len + 2u;
+	}
+
+	return total_len;
+}
+
+/** Starts collecting next (possibly pipelined) message */
+static void dns_stream_next(struct dns_stream *self)
+{
+	self->_len     = 0u;
+	self->_msg_len = 0u;
+}
+
+/** Advances idle timer of the connection */
+static void dns_stream_tick(struct dns_stream *self, uint32_t delta_ms)
+{
+	if ((UINT32_MAX - self->idle_ms) < delta_ms) {
+		self->idle_ms = UINT32_MAX;
+	} else {
+		self->idle_ms += delta_ms;
+	}
+}
+
+/** TLS backend call results */
+#define DNS_TLS_OK    0u /**< Done */
+#define DNS_TLS_AGAIN 1u /**< Waits for transport, call again when ready */
+#define DNS_TLS_ERROR 2u /**< Failed or closed by peer, close connection */
+
+/** TLS backend of DoT connections, implemented by the binding layer over
+ *  any TLS library. `tls` is the backend connection (TLS session over a
+ *  non-blocking socket). Backend buffers decrypted records itself, so reads
+ *  ask only for the bytes the framer still needs. Resumption (tickets or
+ *  `struct dns_tls_session_cache`) is up to the backend handshake */
+struct dns_tls_ops {
+	/** Advances handshake. Returns DNS_TLS_* */
+	uint8_t (*handshake)(void *tls);
+
+	/** Reads up to `cap` decrypted bytes, stores their count into `len`.
+	 *  Returns DNS_TLS_* (AGAIN when nothing is available) */
+	uint8_t (*read)(void *tls, uint8_t *buf, size_t cap, size_t *len);
+
+	/** Writes up to `len` bytes, stores their count into `written`.
+	 *  Returns DNS_TLS_* (AGAIN when transport is full, rest is retried) */
+	uint8_t (*write)(void *tls, const uint8_t *buf, size_t len,
+			 size_t *written);
+
+	/** Returns true if completed handshake resumed a session */
+	bool (*resumed)(void *tls);
+};
+
+/** DoT connection states */
+#define DNS_DOT_HANDSHAKE 0u /**< TLS handshake in progress */
+#define DNS_DOT_READ      1u /**< Collecting query */
+#define DNS_DOT_QUERY     2u /**< Query is ready, answer it */
+#define DNS_DOT_WRITE     3u /**< Sending answer */
+#define DNS_DOT_CLOSED    4u /**< Close connection */
+
+/** DNS over TLS connection (RFC 7858). Drives the stream framer through
+ *  TLS backend callbacks: handshake once, then pipelined queries answered
+ *  in order over the same connection */
+struct dns_dot {
+	const struct dns_tls_ops *_ops; /**< TLS backend */
+	void *_tls;                     /**< Backend connection */
+
+	size_t _out_len; /**< Framed answer length */
+	size_t _out_ofs; /**< Framed answer bytes sent */
+
+	/** Framer, query and answer share it's buffer */
+	struct dns_stream stream;
+
+	/** Connection state, DNS_DOT_* */
+	uint8_t state;
+
+	/** Set if handshake resumed a session (no full handshake) */
+	bool resumed;
+};
+
+/** Initializes DoT connection over backend `ops` and it's connection `tls`.
+ *  Takes framer buffer and it's capacity (see `dns_stream_init`) */
+static void dns_dot_init(struct dns_dot *self, const struct dns_tls_ops *ops,
+			 void *tls, uint8_t *buf, size_t cap)
+{
+	self->_ops = ops;
+	self->_tls = tls;
+
+	self->_out_len = 0u;
+	self->_out_ofs = 0u;
+
+	dns_stream_init(&self->stream, buf, cap);
+
+	self->state   = DNS_DOT_HANDSHAKE;
+	self->resumed = false;
+
+	if ((ops == NULL) || (self->stream.malformed != 0u)) {
+		self->state = DNS_DOT_CLOSED;
+	}
+}
+
+/** Returns number of bytes missing from the message being collected,
+ *  length prefix first */
+static size_t _dns_stream_need(const struct dns_stream *self)
+{
+	size_t need = 2u - self->_len;
+
+	if (self->_len >= 2u) {
+		need = (2u + (size_t)self->_msg_len) - self->_len;
+	}
+
+	return need;
+}
+
+/** Drives connection as far as the transport allows. Call whenever socket
+ *  is ready. Returns state: on DNS_DOT_QUERY the query is at
+ *  `dns_stream_msg` (see `dns_stream_msg_len`), answer it with
+ *  `dns_dot_answer`. On DNS_DOT_CLOSED close the connection */
+static uint8_t dns_dot_poll(struct dns_dot *self)
+{
+	struct dns_stream *stream = &self->stream;
+	uint8_t result = DNS_TLS_OK;
+	uint8_t *data;
+	size_t  need;
+	size_t  len;
+
+	while ((result == DNS_TLS_OK) && (self->state != DNS_DOT_QUERY) &&
+	       (self->state != DNS_DOT_CLOSED)) {
+		len = 0u;
+
+		if (self->state == DNS_DOT_HANDSHAKE) {
+			result = self->_ops->handshake(self->_tls);
+
+			if (result == DNS_TLS_OK) {
+				self->resumed = self->_ops->resumed(self->_tls);
+				self->state   = DNS_DOT_READ;
+			}
+		} else if (self->state == DNS_DOT_READ) {
+			/* Decrypted straight into the framer buffer */
+			data   = &stream->_buf[stream->_len];
+			need   = _dns_stream_need(stream);
+			result = self->_ops->read(self->_tls, data, need, &len);
+
+			if (len > need) {
+				stream->malformed = __LINE__;
+			} else if ((result == DNS_TLS_OK) && (len == 0u)) {
+				result = DNS_TLS_AGAIN;
+			} else {
+				(void)dns_stream_write(stream, data, len);
+			}
+
+			if (stream->malformed != 0u) {
+				result = DNS_TLS_ERROR;
+			} else if (dns_stream_msg_ready(stream)) {
+				self->state = DNS_DOT_QUERY;
+			}
+		} else {
+			data   = &stream->_buf[self->_out_ofs];
+			need   = self->_out_len - self->_out_ofs;
+			result = self->_ops->write(self->_tls, data, need,
+						   &len);
+
+			if (len > need) {
+				result = DNS_TLS_ERROR;
+			} else if ((result == DNS_TLS_OK) && (len == 0u)) {
+				result = DNS_TLS_AGAIN;
+			} else {
+				self->_out_ofs += len;
+			}
+
+			if ((result != DNS_TLS_ERROR) &&
+			    (self->_out_ofs == self->_out_len)) {
+				dns_stream_next(stream);
+				self->state = DNS_DOT_READ;
+			}
+		}
+	}
+
+	if (result == DNS_TLS_ERROR) {
+		self->state = DNS_DOT_CLOSED;
+	}
+
+	return self->state;
+}
+
+/** Sends answer of `len` bytes built over the query (DNS_DOT_QUERY state),
+ *  then goes on with pipelined queries. Zero `len` closes the connection.
+ *  Returns state, like `dns_dot_poll` */
+static uint8_t dns_dot_answer(struct dns_dot *self, size_t len)
+{
+	if (self->state == DNS_DOT_QUERY) {
+		self->_out_len = dns_stream_frame(&self->stream, len);
+		self->_out_ofs = 0u;
+
+		self->state = (self->_out_len > 0u) ? DNS_DOT_WRITE :
+			      DNS_DOT_CLOSED;
+	}
+
+	return dns_dot_poll(self);
+}
+
+/*****************************************************************************
+ * DNS OVER HTTPS (DoH)
+ *****************************************************************************/
+/** DoH media type (RFC 8484) */
+#define DNS_DOH_MEDIA_TYPE "application/dns-message"
+
+/** DoH GET query parameter name (including '=') */
+#define DNS_DOH_PARAM "dns="
+
+/** Case insensitive ASCII byte */
+static uint8_t _dns_ascii_lower(uint8_t c)
+{
+	uint8_t result = c;
+
+	if ((c >= (uint8_t)'A') && (c <= (uint8_t)'Z')) {
+		result = (uint8_t)(c + 0x20u);
+	}
+
+	return result;
+}
+
+/** Returns true if HTTP content type is DoH media type. Media type
+ *  parameters (after ';') are ignored */
+static bool dns_doh_media_type_ok(const char *content_type)
+{
+	const char *expect = DNS_DOH_MEDIA_TYPE;
+	bool result = (content_type != NULL);
+	size_t i = 0u;
+
+	while (result && (expect[i] != '\0')) {
+		if (_dns_ascii_lower((uint8_t)content_type[i]) !=
+		    (uint8_t)expect[i]) {
+			result = false;
+		} else {
+			i++;
+		}
+	}
+
+	if (result) {
+		result = (content_type[i] == '\0') || (content_type[i] == ';') ||
+			 (content_type[i] == ' ');
+	}
+
+	return result;
+}
+
+/** Accepts DoH POST request body. HTTP/2 itself (framing, HPACK, stream
+ *  multiplexing) belongs to the binding layer; each HTTP/2 stream gets
+ *  it's own `struct dns_msg` bound directly to the stream body buffer, so
+ *  the body is parsed and answered in place without re-buffering.
+ *  `body_cap` is the capacity of the body buffer (answer space included).
+ *  Returns true if request is DoH and query is parsed */
+static bool dns_doh_post(struct dns_msg *msg, const char *content_type,
+			 uint8_t *body, size_t body_len, size_t body_cap)
+{
+	bool result = false;
+
+	dns_msg_init(msg, body, body_cap);
+
+	if (!dns_doh_media_type_ok(content_type) || (body_len > body_cap)) {
+		msg->malformed = __LINE__;
+	} else {
+		dns_msg_parse_query(msg, body_len);
+		result = (msg->malformed == 0u);
+	}
+
+	return result;
+}
+
+/** Finds `dns=` parameter in HTTP request target (path with query string).
+ *  Returns pointer to base64url encoded message inside the target (or NULL)
+ *  and stores it's length into `param_len` */
+static char *dns_doh_get_param(char *target, size_t len, size_t *param_len)
+{
+	char *result = NULL;
+	size_t i = 0u;
+	bool in_query = false;
+
+	*param_len = 0u;
+
+	while ((i < len) && (result == NULL)) {
+		bool at_param = false;
+
+		if (!in_query) {
+			in_query = (target[i] == '?');
+		} else if ((target[i - 1u] == '?') ||
+			   (target[i - 1u] == '&')) {
+			at_param = ((len - i) >= 4u) &&
+				   (memcmp(&target[i], DNS_DOH_PARAM, 4u) == 0);
+		} else {}
+
+		if (at_param) {
+			result = &target[i + 4u];
+
+			i += 4u;
+			while ((i < len) && (target[i] != '&') &&
+			       (target[i] != '#')) {
+				(*param_len)++;
+				i++;
+			}
+		} else {
+			i++;
+		}
+	}
+
+	return result;
+}
+
+/** Base64url (RFC 4648 section 5) decoding tables, one per position of
+ *  char in a 4 char block, holding it's 6 bits already shifted into place,
+ *  so a block decodes with four loads and ORs. DNS_B64URL_BAD marks invalid
+ *  char, it stays set in the OR of any block containing one */
+#define DNS_B64URL_BAD 0x01000000u
+
+static const uint32_t _dns_b64url_d0[256] = {
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x00f80000u, 0x01000000u, 0x01000000u,
+	0x00d00000u, 0x00d40000u, 0x00d80000u, 0x00dc0000u,
+	0x00e00000u, 0x00e40000u, 0x00e80000u, 0x00ec0000u,
+	0x00f00000u, 0x00f40000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x00000000u, 0x00040000u, 0x00080000u,
+	0x000c0000u, 0x00100000u, 0x00140000u, 0x00180000u,
+	0x001c0000u, 0x00200000u, 0x00240000u, 0x00280000u,
+	0x002c0000u, 0x00300000u, 0x00340000u, 0x00380000u,
+	0x003c0000u, 0x00400000u, 0x00440000u, 0x00480000u,
+	0x004c0000u, 0x00500000u, 0x00540000u, 0x00580000u,
+	0x005c0000u, 0x00600000u, 0x00640000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x00fc0000u,
+	0x01000000u, 0x00680000u, 0x006c0000u, 0x00700000u,
+	0x00740000u, 0x00780000u, 0x007c0000u, 0x00800000u,
+	0x00840000u, 0x00880000u, 0x008c0000u, 0x00900000u,
+	0x00940000u, 0x00980000u, 0x009c0000u, 0x00a00000u,
+	0x00a40000u, 0x00a80000u, 0x00ac0000u, 0x00b00000u,
+	0x00b40000u, 0x00b80000u, 0x00bc0000u, 0x00c00000u,
+	0x00c40000u, 0x00c80000u, 0x00cc0000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u
+};
+
+static const uint32_t _dns_b64url_d1[256] = {
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x0003e000u, 0x01000000u, 0x01000000u,
+	0x00034000u, 0x00035000u, 0x00036000u, 0x00037000u,
+	0x00038000u, 0x00039000u, 0x0003a000u, 0x0003b000u,
+	0x0003c000u, 0x0003d000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x00000000u, 0x00001000u, 0x00002000u,
+	0x00003000u, 0x00004000u, 0x00005000u, 0x00006000u,
+	0x00007000u, 0x00008000u, 0x00009000u, 0x0000a000u,
+	0x0000b000u, 0x0000c000u, 0x0000d000u, 0x0000e000u,
+	0x0000f000u, 0x00010000u, 0x00011000u, 0x00012000u,
+	0x00013000u, 0x00014000u, 0x00015000u, 0x00016000u,
+	0x00017000u, 0x00018000u, 0x00019000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x0003f000u,
+	0x01000000u, 0x0001a000u, 0x0001b000u, 0x0001c000u,
+	0x0001d000u, 0x0001e000u, 0x0001f000u, 0x00020000u,
+	0x00021000u, 0x00022000u, 0x00023000u, 0x00024000u,
+	0x00025000u, 0x00026000u, 0x00027000u, 0x00028000u,
+	0x00029000u, 0x0002a000u, 0x0002b000u, 0x0002c000u,
+	0x0002d000u, 0x0002e000u, 0x0002f000u, 0x00030000u,
+	0x00031000u, 0x00032000u, 0x00033000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u
+};
+
+static const uint32_t _dns_b64url_d2[256] = {
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x00000f80u, 0x01000000u, 0x01000000u,
+	0x00000d00u, 0x00000d40u, 0x00000d80u, 0x00000dc0u,
+	0x00000e00u, 0x00000e40u, 0x00000e80u, 0x00000ec0u,
+	0x00000f00u, 0x00000f40u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x00000000u, 0x00000040u, 0x00000080u,
+	0x000000c0u, 0x00000100u, 0x00000140u, 0x00000180u,
+	0x000001c0u, 0x00000200u, 0x00000240u, 0x00000280u,
+	0x000002c0u, 0x00000300u, 0x00000340u, 0x00000380u,
+	0x000003c0u, 0x00000400u, 0x00000440u, 0x00000480u,
+	0x000004c0u, 0x00000500u, 0x00000540u, 0x00000580u,
+	0x000005c0u, 0x00000600u, 0x00000640u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x00000fc0u,
+	0x01000000u, 0x00000680u, 0x000006c0u, 0x00000700u,
+	0x00000740u, 0x00000780u, 0x000007c0u, 0x00000800u,
+	0x00000840u, 0x00000880u, 0x000008c0u, 0x00000900u,
+	0x00000940u, 0x00000980u, 0x000009c0u, 0x00000a00u,
+	0x00000a40u, 0x00000a80u, 0x00000ac0u, 0x00000b00u,
+	0x00000b40u, 0x00000b80u, 0x00000bc0u, 0x00000c00u,
+	0x00000c40u, 0x00000c80u, 0x00000cc0u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u
+};
+
+static const uint32_t _dns_b64url_d3[256] = {
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x0000003eu, 0x01000000u, 0x01000000u,
+	0x00000034u, 0x00000035u, 0x00000036u, 0x00000037u,
+	0x00000038u, 0x00000039u, 0x0000003au, 0x0000003bu,
+	0x0000003cu, 0x0000003du, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x00000000u, 0x00000001u, 0x00000002u,
+	0x00000003u, 0x00000004u, 0x00000005u, 0x00000006u,
+	0x00000007u, 0x00000008u, 0x00000009u, 0x0000000au,
+	0x0000000bu, 0x0000000cu, 0x0000000du, 0x0000000eu,
+	0x0000000fu, 0x00000010u, 0x00000011u, 0x00000012u,
+	0x00000013u, 0x00000014u, 0x00000015u, 0x00000016u,
+	0x00000017u, 0x00000018u, 0x00000019u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x0000003fu,
+	0x01000000u, 0x0000001au, 0x0000001bu, 0x0000001cu,
+	0x0000001du, 0x0000001eu, 0x0000001fu, 0x00000020u,
+	0x00000021u, 0x00000022u, 0x00000023u, 0x00000024u,
+	0x00000025u, 0x00000026u, 0x00000027u, 0x00000028u,
+	0x00000029u, 0x0000002au, 0x0000002bu, 0x0000002cu,
+	0x0000002du, 0x0000002eu, 0x0000002fu, 0x00000030u,
+	0x00000031u, 0x00000032u, 0x00000033u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u,
+	0x01000000u, 0x01000000u, 0x01000000u, 0x01000000u
+};
+
+/** Decodes 4 char block at `p` into 24 bits, DNS_B64URL_BAD set if block
+ *  is invalid */
+static uint32_t _dns_b64url_block(const uint8_t *p)
+{
+	return _dns_b64url_d0[p[0]] | _dns_b64url_d1[p[1]] |
+	       _dns_b64url_d2[p[2]] | _dns_b64url_d3[p[3]];
+}
+
+/** Decodes base64url text into `dst`. Trailing padding is optional.
+ *  Decodes 8 chars into 6 bytes per step (two table driven blocks), with
+ *  validity checked once for the whole text instead of per char. Output
+ *  never outruns input, so `dst` may alias `src` (in place). Returns
+ *  number of decoded bytes, or 0 if text is invalid or doesn't fit */
+static size_t dns_b64url_decode(uint8_t *dst, size_t cap, const char *src,
+				size_t len)
+{
+	const uint8_t *s = (const uint8_t *)src;
+	size_t   i = 0u;
+	size_t   o = 0u;
+	uint32_t x;
+	uint32_t y;
+	uint32_t err = 0u;
+	size_t   text_len = len;
+	size_t   tail;
+	size_t   out_len;
+
+	/* Strip optional padding */
+	while ((text_len > 0u) && (src[text_len - 1u] == '=')) {
+		text_len--;
+	}
+
+	tail    = text_len & 3u;
+	out_len = ((text_len / 4u) * 3u) + ((tail > 0u) ? (tail - 1u) : 0u);
+
+	if ((tail == 1u) || (out_len > cap)) {
+		err = DNS_B64URL_BAD;
+		text_len = 0u;
+		tail = 0u;
+	}
+
+	/* Both blocks are read before anything is written (in place) */
+	while ((i + 8u) <= text_len) {
+		x = _dns_b64url_block(&s[i]);
+		y = _dns_b64url_block(&s[i + 4u]);
+		err |= x | y;
+
+		dst[o + 0u] = (uint8_t)(x >> 16);
+		dst[o + 1u] = (uint8_t)(x >> 8);
+		dst[o + 2u] = (uint8_t)(x >> 0);
+		dst[o + 3u] = (uint8_t)(y >> 16);
+		dst[o + 4u] = (uint8_t)(y >> 8);
+		dst[o + 5u] = (uint8_t)(y >> 0);
+
+		i += 8u;
+		o += 6u;
+	}
+
+	if ((i + 4u) <= text_len) {
+		x = _dns_b64url_block(&s[i]);
+		err |= x;
+
+		dst[o + 0u] = (uint8_t)(x >> 16);
+		dst[o + 1u] = (uint8_t)(x >> 8);
+		dst[o + 2u] = (uint8_t)(x >> 0);
+
+		i += 4u;
+		o += 3u;
+	}
+
+	/* Tail: 2 chars -> 1 byte, 3 chars -> 2 bytes */
+	if (tail > 0u) {
+		x = _dns_b64url_d0[s[i]] | _dns_b64url_d1[s[i + 1u]] |
+		    ((tail == 3u) ? _dns_b64url_d2[s[i + 2u]] : 0u);
+		err |= x;
+
+		dst[o] = (uint8_t)(x >> 16);
+		o++;
+
+		if (tail == 3u) {
+			dst[o] = (uint8_t)(x >> 8);
+			o++;
+		}
+	}
+
+	return ((err & DNS_B64URL_BAD) == 0u) ? o : 0u;
+}
+
+/** Accepts DoH GET request target. Decodes `dns=` parameter directly into
+ *  `buf` and parses it. `buf` may point to the target itself (decoded in
+ *  place). Returns true if query is parsed */
+static bool dns_doh_get(struct dns_msg *msg, char *target, size_t len,
+			uint8_t *buf, size_t cap)
+{
+	bool   result = false;
+	size_t param_len;
+	size_t msg_len = 0u;
+	char  *param = dns_doh_get_param(target, len, &param_len);
+
+	if (param != NULL) {
+		msg_len = dns_b64url_decode(buf, cap, param, param_len);
+	}
+
+	dns_msg_init(msg, buf, cap);
+
+	if (msg_len == 0u) {
+		msg->malformed = __LINE__;
+	} else {
+		dns_msg_parse_query(msg, msg_len);
+		result = (msg->malformed == 0u);
+	}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS MESSAGE CONTEXT
+ *****************************************************************************/
+/** Address families of `struct dns_addr` */
+#define DNS_ADDR_NONE 0u
+#define DNS_ADDR_IPV4 4u
+#define DNS_ADDR_IPV6 6u
+
+/** Transports a message may arrive on */
+#define DNS_TRANSPORT_UDP 0u
+#define DNS_TRANSPORT_TCP 1u
+#define DNS_TRANSPORT_DOT 2u
+#define DNS_TRANSPORT_DOH 3u
+
+/** IPv4 or IPv6 address with port. Stored in network byte order, IPv4 uses
+ *  first 4 bytes */
+struct dns_addr {
+	uint8_t  family;    /**< DNS_ADDR_* */
+	uint8_t  bytes[16]; /**< Address bytes (network byte order) */
+	uint16_t port;      /**< Port (host byte order) */
+};
+
+/** Per-message context, lives alongside `struct dns_msg`. Filled by the
+ *  binding layer on receive, so every feature that needs to know about the
+ *  client (rate limiting, ACLs, logging) finds it in one place */
+struct dns_msg_ctx {
+	struct dns_addr client; /**< Client (source) address */
+	struct dns_addr local;  /**< Local (destination) address */
+
+	uint8_t  transport; /**< DNS_TRANSPORT_* */
+	uint32_t ifindex;   /**< Receiving interface index, 0 if unknown */
+
+	/** Receive timestamp, 0 if unknown */
+	uint64_t rx_time_ns;
+};
+
+/** Clears address */
+static void dns_addr_init(struct dns_addr *self)
+{
+	self->family = DNS_ADDR_NONE;
+	(void)memset(self->bytes, 0, sizeof(self->bytes));
+	self->port = 0u;
+}
+
+/** Sets address from raw bytes. `len` is 4 (IPv4) or 16 (IPv6) */
+static void dns_addr_set(struct dns_addr *self, const uint8_t *bytes,
+			 size_t len, uint16_t port)
+{
+	dns_addr_init(self);
+
+	if ((len == 4u) || (len == 16u)) {
+		self->family = (len == 4u) ? DNS_ADDR_IPV4 : DNS_ADDR_IPV6;
+		(void)memcpy(self->bytes, bytes, len);
+		self->port = port;
+	}
+}
+
+/** Initializes message context */
+static void dns_msg_ctx_init(struct dns_msg_ctx *self, uint8_t transport,
+			     uint32_t ifindex, uint64_t rx_time_ns)
+{
+	dns_addr_init(&self->client);
+	dns_addr_init(&self->local);
+
+	self->transport  = transport;
+	self->ifindex    = ifindex;
+	self->rx_time_ns = rx_time_ns;
+}
+
+/** PROXY protocol v2 signature */
+static const uint8_t _dns_proxy_v2_sig[12] = {
+	0x0D, 0x0A, 0x0D, 0x0A, 0x00, 0x0D, 0x0A, 0x51, 0x55, 0x49, 0x54, 0x0A
+};
+
+/** Parses PROXY protocol v2 header sent by a load balancer in front of
+ *  TCP/DoT listener, before any stream data. Replaces client and local
+ *  address in `ctx` with the ones load balancer has seen. TLVs are skipped.
+ *  Returns number of header bytes to skip, 0 if more bytes are needed.
+ *  Sets `malformed` to __LINE__ if header is not valid (close connection) */
+static size_t dns_proxy_v2_parse(struct dns_msg_ctx *ctx, const uint8_t *buf,
+				 size_t len, uint32_t *malformed)
+{
+	size_t   result = 0u;
+	size_t   hdr_len;
+	uint8_t  ver_cmd;
+	uint8_t  fam;
+	uint16_t src_port;
+	uint16_t dst_port;
+
+	if ((len >= 12u) && (memcmp(buf, _dns_proxy_v2_sig, 12u) != 0)) {
+		*malformed = __LINE__;
+	} else if (len >= 16u) {
+		ver_cmd = buf[12];
+		fam     = buf[13];
+		hdr_len = 16u + (((size_t)buf[14] << 8) | (size_t)buf[15]);
+
+		if ((ver_cmd & 0xF0u) != 0x20u) {
+			*malformed = __LINE__;
+		} else if (len < hdr_len) {
+			/* Need more bytes */
+		} else if ((ver_cmd & 0x0Fu) == 0x00u) {
+			/* LOCAL command: keep real connection addresses */
+			result = hdr_len;
+		} else if ((ver_cmd & 0x0Fu) != 0x01u) {
+			*malformed = __LINE__;
+		} else if (((fam >> 4) == 0x1u) && (hdr_len >= 28u)) {
+			/* AF_INET: src(4) dst(4) src_port(2) dst_port(2) */
+			src_port = (uint16_t)((buf[24] << 8) | buf[25]);
+			dst_port = (uint16_t)((buf[26] << 8) | buf[27]);
+
+			dns_addr_set(&ctx->client, &buf[16], 4u, src_port);
+			dns_addr_set(&ctx->local,  &buf[20], 4u, dst_port);
+
+			result = hdr_len;
+		} else if (((fam >> 4) == 0x2u) && (hdr_len >= 52u)) {
+			/* AF_INET6: src(16) dst(16) src_port(2) dst_port(2) */
+			src_port = (uint16_t)((buf[48] << 8) | buf[49]);
+			dst_port = (uint16_t)((buf[50] << 8) | buf[51]);
+
+			dns_addr_set(&ctx->client, &buf[16], 16u, src_port);
+			dns_addr_set(&ctx->local,  &buf[32], 16u, dst_port);
+
+			result = hdr_len;
+		} else if ((fam >> 4) == 0x0u) {
+			/* AF_UNSPEC: addresses unknown, keep real ones */
+			result = hdr_len;
+		} else {
+			*malformed = __LINE__;
+		}
 	} else {}
 
 	return result;
 }
+
+/*****************************************************************************
+ * DNS LATENCY ACCOUNTING
+ *****************************************************************************/
+/** Number of latency histogram buckets. Bucket N counts latencies in
+ *  [2^N, 2^(N+1)) ns, last bucket also counts everything above */
+#define DNS_LATENCY_BUCKETS 32u
+
+/** Sets context receive timestamp from seconds and nanoseconds parts.
+ *  Binding layer should pass kernel receive timestamp here (for example
+ *  SO_TIMESTAMPNS control message of recvmmsg), so the time packet spent
+ *  queued in the kernel is accounted too */
+static void dns_msg_ctx_set_rx_time(struct dns_msg_ctx *self, uint64_t sec,
+				    uint32_t nsec)
+{
+	self->rx_time_ns = (sec * 1000000000u) + (uint64_t)nsec;
+}
+
+/** End-to-end (wire to send) latency histogram. One per worker */
+struct dns_latency {
+	uint32_t buckets[DNS_LATENCY_BUCKETS]; /**< log2 histogram */
+
+	uint32_t count;   /**< Number of recorded latencies */
+	uint32_t unknown; /**< Messages without usable receive timestamp */
+
+	uint64_t sum_ns; /**< Sum of recorded latencies */
+	uint64_t max_ns; /**< Maximum recorded latency */
+};
+
+/** Initializes latency histogram */
+static void dns_latency_init(struct dns_latency *self)
+{
+	(void)memset(self->buckets, 0, sizeof(self->buckets));
+
+	self->count   = 0u;
+	self->unknown = 0u;
+
+	self->sum_ns = 0u;
+	self->max_ns = 0u;
+}
+
+/** Records latency between message receive timestamp (from `ctx`) and
+ *  the moment answer is handed to the kernel (`tx_time_ns`, taken right
+ *  before sendmmsg, same clock as receive timestamp) */
+static void dns_latency_record(struct dns_latency *self,
+			       const struct dns_msg_ctx *ctx,
+			       uint64_t tx_time_ns)
+{
+	uint64_t latency_ns;
+	uint8_t  bucket = 0u;
+
+	if ((ctx->rx_time_ns == 0u) || (tx_time_ns < ctx->rx_time_ns)) {
+		self->unknown++;
+	} else {
+		latency_ns = tx_time_ns - ctx->rx_time_ns;
+
+		/* floor(log2(latency_ns)) */
+		while (((latency_ns >> bucket) > 1u) &&
+		       (bucket < (DNS_LATENCY_BUCKETS - 1u))) {
+			bucket++;
+		}
+
+		self->buckets[bucket]++;
+		self->count++;
+
+		self->sum_ns += latency_ns;
+
+		if (latency_ns > self->max_ns) {
+			self->max_ns = latency_ns;
+		}
+	}
+}
+
+/** Returns upper bound of the latency (in ns) below which `permille` of
+ *  recorded latencies are. For example 990 is p99. Returns 0 if empty */
+static uint64_t dns_latency_percentile(const struct dns_latency *self,
+				       uint32_t permille)
+{
+	uint64_t result = 0u;
+	uint64_t target = ((uint64_t)self->count * permille + 999u) / 1000u;
+	uint64_t seen = 0u;
+	uint8_t  i = 0u;
+
+	while ((self->count > 0u) && (result == 0u) &&
+	       (i < DNS_LATENCY_BUCKETS)) {
+		seen += self->buckets[i];
+
+		if ((seen >= target) && (seen > 0u)) {
+			result = ((uint64_t)1u << (i + 1u)) - 1u;
+		}
+
+		i++;
+	}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS ADMISSION CONTROL (LOAD SHEDDING)
+ *****************************************************************************/
+/** DNS record types */
+#define DNS_TYPE_A     1u
+#define DNS_TYPE_HINFO 13u
+#define DNS_TYPE_TXT   16u
+#define DNS_TYPE_AAAA  28u
+#define DNS_TYPE_OPT   41u
+#define DNS_TYPE_DS    43u
+#define DNS_TYPE_ANY   255u
+
+/** EDNS COOKIE option code (RFC 7873) */
+#define DNS_EDNS_COOKIE 10u
+
+/** Query priorities, lowest priority is shed first */
+#define DNS_PRIO_ANY_TXT   0u /**< ANY/TXT without cookie (amplification) */
+#define DNS_PRIO_UNKNOWN   1u /**< Unknown client without cookie */
+#define DNS_PRIO_NO_COOKIE 2u /**< Known client without cookie */
+#define DNS_PRIO_COOKIE    3u /**< Valid server cookie, never shed */
+
+/** Finds EDNS COOKIE option of parsed query (OPT record right after the
+ *  question). Returns pointer to cookie bytes (client cookie, optionally
+ *  followed by server cookie) and stores it's length into `len`.
+ *  Returns NULL if there is no cookie. Server cookie validation is up to
+ *  the caller (it depends on server secret) */
+static const uint8_t *dns_msg_get_cookie(struct dns_msg *self, size_t *len)
+{
+	const uint8_t *result = NULL;
+	const uint8_t *p = self->_packet_buf;
+	size_t ofs = self->_ofs;
+	size_t end;
+
+	*len = 0u;
+
+	/* No answer and authority records, at least one additional.
+	 * OPT record: root name, type, class, ttl, rdlen */
+	if ((self->malformed == 0u) && (p[4] == 0u) && (p[5] == 1u) &&
+	    (p[6] == 0u) && (p[7] == 0u) && (p[8] == 0u) && (p[9] == 0u) &&
+	    ((p[10] != 0u) || (p[11] != 0u)) &&
+	    ((ofs + 11u) <= self->_packet_len) && (p[ofs] == 0u) &&
+	    (p[ofs + 1u] == 0u) && (p[ofs + 2u] == DNS_TYPE_OPT)) {
+		end = ofs + 11u + (((size_t)p[ofs + 9u] << 8) | p[ofs + 10u]);
+		ofs += 11u;
+
+		if (end > self->_packet_len) {
+			end = ofs; /* Truncated OPT, ignore */
+		}
+
+		/* Walk EDNS options: code(2) len(2) data */
+		while ((result == NULL) && ((ofs + 4u) <= end)) {
+			uint16_t code = (uint16_t)((p[ofs] << 8) | p[ofs + 1u]);
+			size_t   opt_len = ((size_t)p[ofs + 2u] << 8) |
+					   p[ofs + 3u];
+
+			if ((ofs + 4u + opt_len) > end) {
+				ofs = end;
+			} else if ((code == DNS_EDNS_COOKIE) &&
+				   (opt_len >= 8u) && (opt_len <= 40u)) {
+				result = &p[ofs + 4u];
+				*len = opt_len;
+			} else {
+				ofs += 4u + opt_len;
+			}
+		}
+	}
+
+	return result;
+}
+
+/** Classifies parsed query into DNS_PRIO_*. `cookie_ok` is true if query
+ *  carries valid server cookie, `known_client` if client is known to the
+ *  binding layer (allow list, previous TCP connection and so on) */
+static uint8_t dns_msg_get_prio(struct dns_msg *self, bool cookie_ok,
+				bool known_client)
+{
+	uint8_t result = DNS_PRIO_NO_COOKIE;
+
+	if (cookie_ok) {
+		result = DNS_PRIO_COOKIE;
+	} else if ((self->query_type == DNS_TYPE_ANY) ||
+		   (self->query_type == DNS_TYPE_TXT)) {
+		result = DNS_PRIO_ANY_TXT;
+	} else if (!known_client) {
+		result = DNS_PRIO_UNKNOWN;
+	} else {}
+
+	return result;
+}
+
+/** Per worker admission control. Tracks receive queue depth and smoothed
+ *  processing latency. When worker is overloaded, queries are shed by
+ *  priority instead of slowing down every query (and making clients
+ *  retry, which amplifies load even further) */
+struct dns_admission {
+	uint32_t queue_max;      /**< Queue depth treated as overload */
+	uint32_t latency_max_us; /**< Latency treated as overload */
+
+	uint32_t queue_depth;     /**< Last reported queue depth */
+	uint32_t latency_avg_us;  /**< Smoothed processing latency */
+
+	/** Shedding level. Queries with priority below it are shed */
+	uint8_t level;
+
+	uint32_t admitted; /**< Number of admitted queries */
+	uint32_t shed;     /**< Number of shed queries */
+};
+
+/** Initializes admission control with overload thresholds */
+static void dns_admission_init(struct dns_admission *self, uint32_t queue_max,
+			       uint32_t latency_max_us)
+{
+	self->queue_max      = (queue_max > 0u) ? queue_max : 1u;
+	self->latency_max_us = (latency_max_us > 0u) ? latency_max_us : 1u;
+
+	self->queue_depth    = 0u;
+	self->latency_avg_us = 0u;
+
+	self->level = 0u;
+
+	self->admitted = 0u;
+	self->shed     = 0u;
+}
+
+/** Reports worker state, call once per receive batch. `queue_depth` is
+ *  number of pending packets (for example batch fill level or SIOCINQ),
+ *  `latency_us` is processing latency of the batch. Shedding level goes up
+ *  one step per update while overloaded and goes down one step while load
+ *  is below half of the thresholds (hysteresis) */
+static void dns_admission_update(struct dns_admission *self,
+				 uint32_t queue_depth, uint32_t latency_us)
+{
+	bool over;
+	bool under;
+
+	self->queue_depth = queue_depth;
+
+	/* Exponential moving average, alpha = 1/8 */
+	self->latency_avg_us = self->latency_avg_us -
+			       (self->latency_avg_us / 8u) + (latency_us / 8u);
+
+	over  = (queue_depth >= self->queue_max) ||
+		(self->latency_avg_us >= self->latency_max_us);
+	under = (queue_depth < (self->queue_max / 2u)) &&
+		(self->latency_avg_us < (self->latency_max_us / 2u));
+
+	if (over && (self->level < DNS_PRIO_COOKIE)) {
+		self->level++;
+	} else if (under && (self->level > 0u)) {
+		self->level--;
+	} else {}
+}
+
+/** Returns true if query of priority `prio` (DNS_PRIO_*) is admitted */
+static bool dns_admission_admit(struct dns_admission *self, uint8_t prio)
+{
+	bool result = (prio >= self->level);
+
+	if (result) {
+		self->admitted++;
+	} else {
+		self->shed++;
+	}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS CPU AFFINITY (RSS QUEUE TO WORKER MAPPING)
+ *****************************************************************************/
+/** Maximum number of CPUs in the map */
+#define DNS_CPU_MAP_MAX 256u
+
+/** Marks unmapped entry */
+#define DNS_CPU_NONE 0xFFFFu
+
+/** Approximate per-packet kernel bookkeeping (skb truesize) overhead */
+#define DNS_SOCK_PKT_OVERHEAD 768u
+
+/** Maps NIC RX queues, CPUs which service their interrupts and
+ *  SO_REUSEPORT workers, so every packet is processed on the core that
+ *  received it. Binding layer (dns_tools.cpu.c) fills it from
+ *  /proc/interrupts (`dns_cpu_discover`), then:
+ *  - pins worker N to `dns_cpu_map_worker_cpu(N)` and sets SO_INCOMING_CPU
+ *    of it's socket to the same CPU (`dns_cpu_bind_worker`);
+ *  - or also loads `cpu_worker` into the CPU keyed reuseport selector
+ *    (dns_tools.cpu.bpf.c, `dns_cpu_attach`). A group runs one program,
+ *    so this replaces QNAME hash steering.
+ *  A simulated mapping (for example on loopback) works the same way */
+struct dns_cpu_map {
+	/** Worker serving packets received on CPU, DNS_CPU_NONE if unknown */
+	uint16_t cpu_worker[DNS_CPU_MAP_MAX];
+
+	/** CPU of worker (IRQ CPU of it's RX queue), DNS_CPU_NONE if unset */
+	uint16_t worker_cpu[DNS_CPU_MAP_MAX];
+
+	uint16_t workers; /**< Number of workers (and RX queues) */
+
+	/** Set to __LINE__ if something is not right */
+	uint32_t malformed;
+};
+
+/** Initializes empty map */
+static void dns_cpu_map_init(struct dns_cpu_map *self)
+{
+	uint16_t i;
+
+	for (i = 0u; i < DNS_CPU_MAP_MAX; i++) {
+		self->cpu_worker[i] = DNS_CPU_NONE;
+		self->worker_cpu[i] = DNS_CPU_NONE;
+	}
+
+	self->workers   = 0u;
+	self->malformed = 0u;
+}
+
+/** Adds RX queue serviced by `irq_cpu`. One worker is created per queue.
+ *  Returns worker index */
+static uint16_t dns_cpu_map_add_queue(struct dns_cpu_map *self,
+				      uint16_t irq_cpu)
+{
+	uint16_t worker = DNS_CPU_NONE;
+
+	if ((irq_cpu >= DNS_CPU_MAP_MAX) ||
+	    (self->workers >= DNS_CPU_MAP_MAX) ||
+	    (self->cpu_worker[irq_cpu] != DNS_CPU_NONE)) {
+		self->malformed = __LINE__;
+	} else {
+		worker = self->workers;
+
+		self->cpu_worker[irq_cpu] = worker;
+		self->worker_cpu[worker]  = irq_cpu;
+		self->workers++;
+	}
+
+	return worker;
+}
+
+/** Returns CPU the worker should be pinned to (and SO_INCOMING_CPU) */
+static uint16_t dns_cpu_map_worker_cpu(const struct dns_cpu_map *self,
+				       uint16_t worker)
+{
+	uint16_t result = DNS_CPU_NONE;
+
+	if (worker < self->workers) {
+		result = self->worker_cpu[worker];
+	}
+
+	return result;
+}
+
+/** Selects worker for packet received on `cpu`. CPUs without RX queue
+ *  (RPS, misconfigured IRQ affinity) are spread over workers */
+static uint16_t dns_cpu_map_select(const struct dns_cpu_map *self,
+				   uint16_t cpu)
+{
+	uint16_t result = DNS_CPU_NONE;
+
+	if (self->workers > 0u) {
+		if ((cpu < DNS_CPU_MAP_MAX) &&
+		    (self->cpu_worker[cpu] != DNS_CPU_NONE)) {
+			result = self->cpu_worker[cpu];
+		} else {
+			result = (uint16_t)(cpu % self->workers);
+		}
+	}
+
+	return result;
+}
+
+/** Returns socket receive buffer size (SO_RCVBUF) needed to absorb
+ *  `queue_ms` worth of `pkts_per_s` packets of `pkt_size` bytes */
+static uint32_t dns_sock_buf_size(uint32_t pkts_per_s, uint32_t queue_ms,
+				  uint32_t pkt_size)
+{
+	uint64_t pkts = ((uint64_t)pkts_per_s * queue_ms) / 1000u;
+	uint64_t size = pkts * ((uint64_t)pkt_size + DNS_SOCK_PKT_OVERHEAD);
+
+	return (size > UINT32_MAX) ? UINT32_MAX : (uint32_t)size;
+}
+
+/*****************************************************************************
+ * DNS WORKER STEERING
+ *****************************************************************************/
+/** FNV-1a offset basis and prime */
+#define DNS_HASH_BASIS 2166136261u
+#define DNS_HASH_PRIME 16777619u
+
+/** Maximum length of domain name in wire format */
+#define DNS_NAME_WIRE_MAX 255u
+
+/** Hashes binary key (32 bit FNV-1a, bytes taken as is) */
+static uint32_t dns_hash_bytes(const uint8_t *data, size_t len)
+{
+	uint32_t hash = DNS_HASH_BASIS;
+	size_t i;
+
+	for (i = 0u; i < len; i++) {
+		hash ^= (uint32_t)data[i];
+		hash *= DNS_HASH_PRIME;
+	}
+
+	return hash;
+}
+
+/** Hashes domain name in wire format, case insensitive (32 bit FNV-1a over
+ *  case folded bytes, label lengths included). Loop is bounded and uses
+ *  only byte operations, so the reuseport selector
+ *  (dns_tools.reuseport.bpf.c) computes the very same hash in kernel */
+static uint32_t dns_name_hash(const uint8_t *wire, size_t len)
+{
+	uint32_t hash = DNS_HASH_BASIS;
+	size_t i;
+
+	for (i = 0u; (i < len) && (i < DNS_NAME_WIRE_MAX); i++) {
+		hash ^= (uint32_t)_dns_ascii_lower(wire[i]);
+		hash *= DNS_HASH_PRIME;
+	}
+
+	return hash;
+}
+
+/** Hashes QNAME of parsed query (see `dns_name_hash`) */
+static uint32_t dns_msg_qname_hash(struct dns_msg *self)
+{
+	return dns_name_hash(&self->_packet_buf[12], self->_qname_len);
+}
+
+/** Maps name hash onto one of `workers` (multiply-shift, no division).
+ *  Steering queries by QNAME hash (SO_ATTACH_REUSEPORT_EBPF) makes each
+ *  worker cache shard see it's own consistent subset of names */
+static uint32_t dns_worker_select(uint32_t hash, uint32_t workers)
+{
+	return (uint32_t)(((uint64_t)hash * workers) >> 32);
+}
+
+/*****************************************************************************
+ * DNS TLS SESSION CACHE (DoT RESUMPTION)
+ *****************************************************************************/
+/** Longest session ID kept (TLS 1.2 session ID, TLS 1.3 ticket identity) */
+#define DNS_TLS_SESSION_ID_MAX 32u
+
+/** Longest serialized session kept (no peer certificate, as DoT clients
+ *  don't present one) */
+#define DNS_TLS_SESSION_STATE_MAX 256u
+
+/** Cached TLS session */
+struct dns_tls_session {
+	/** Serialized session, as exported by the TLS backend */
+	uint8_t  state[DNS_TLS_SESSION_STATE_MAX];
+	uint8_t  id[DNS_TLS_SESSION_ID_MAX];
+	uint32_t expire_s; /**< Time it expires at */
+	uint16_t len;      /**< Serialized session length */
+	uint8_t  id_len;   /**< Session ID length, 0 marks free entry */
+};
+
+/** Server side TLS session cache, so returning DoT clients skip the full
+ *  handshake. Session cache hooks of the TLS backend store and look up
+ *  serialized sessions by session ID (or stateful ticket identity) here.
+ *  Direct mapped over caller storage, a new session replaces the one in
+ *  it's slot. Stateless tickets need no cache, only the backend ticket key */
+struct dns_tls_session_cache {
+	struct dns_tls_session *_entries; /**< Entries (caller storage) */
+	uint32_t _cap;                    /**< Entries, power of two */
+
+	/** How long sessions stay resumable */
+	uint32_t lifetime_s;
+
+	uint32_t hits;   /**< Sessions resumed */
+	uint32_t misses; /**< Sessions not found or expired */
+
+	/** Set to __LINE__ if something is not right */
+	uint32_t malformed;
+};
+
+/** Initializes session cache over `cap` entries (power of two), sessions
+ *  stay resumable for `lifetime_s` */
+static void dns_tls_session_cache_init(struct dns_tls_session_cache *self,
+				       struct dns_tls_session *entries,
+				       uint32_t cap, uint32_t lifetime_s)
+{
+	uint32_t i;
+
+	self->_entries = entries;
+	self->_cap     = cap;
+
+	self->lifetime_s = lifetime_s;
+
+	self->hits   = 0u;
+	self->misses = 0u;
+
+	self->malformed = 0u;
+
+	if ((entries == NULL) || (cap == 0u) || ((cap & (cap - 1u)) != 0u)) {
+		self->_cap      = 0u;
+		self->malformed = __LINE__;
+	}
+
+	for (i = 0u; i < self->_cap; i++) {
+		entries[i].id_len = 0u;
+	}
+}
+
+/** Returns entry of session `id`, NULL if cache is not usable */
+static struct dns_tls_session *_dns_tls_session_slot(
+	const struct dns_tls_session_cache *self, const uint8_t *id,
+	size_t id_len)
+{
+	struct dns_tls_session *entry = NULL;
+
+	if ((self->_cap > 0u) && (id_len > 0u) &&
+	    (id_len <= DNS_TLS_SESSION_ID_MAX)) {
+		entry = &self->_entries[dns_hash_bytes(id, id_len) &
+					(self->_cap - 1u)];
+	}
+
+	return entry;
+}
+
+/** Returns true if `entry` holds live session `id` */
+static bool _dns_tls_session_live(const struct dns_tls_session *entry,
+				  const uint8_t *id, size_t id_len,
+				  uint32_t now_s)
+{
+	return (entry != NULL) && (entry->id_len == id_len) &&
+	       (memcmp(entry->id, id, id_len) == 0) &&
+	       (now_s < entry->expire_s);
+}
+
+/** Stores serialized session `state` of `len` bytes under session `id`.
+ *  Returns false if it doesn't fit (backend then falls back to a full
+ *  handshake next time) */
+static bool dns_tls_session_put(struct dns_tls_session_cache *self,
+				const uint8_t *id, size_t id_len,
+				const uint8_t *state, size_t len,
+				uint32_t now_s)
+{
+	struct dns_tls_session *entry = _dns_tls_session_slot(self, id, id_len);
+	bool stored = (entry != NULL) && (len > 0u) &&
+		      (len <= DNS_TLS_SESSION_STATE_MAX);
+
+	if (stored) {
+		(void)memcpy(entry->state, state, len);
+		(void)memcpy(entry->id, id, id_len);
+
+		entry->expire_s = now_s + self->lifetime_s;
+		entry->len      = (uint16_t)len;
+		entry->id_len   = (uint8_t)id_len;
+	}
+
+	return stored;
+}
+
+/** Looks up session `id`. Returns serialized session and stores it's length
+ *  into `len`, NULL if not found or expired */
+static const uint8_t *dns_tls_session_get(struct dns_tls_session_cache *self,
+					  const uint8_t *id, size_t id_len,
+					  uint32_t now_s, size_t *len)
+{
+	struct dns_tls_session *entry = _dns_tls_session_slot(self, id, id_len);
+	const uint8_t *state = NULL;
+
+	*len = 0u;
+
+	if (_dns_tls_session_live(entry, id, id_len, now_s)) {
+		state = entry->state;
+		*len  = entry->len;
+
+		self->hits++;
+	} else {
+		self->misses++;
+	}
+
+	return state;
+}
+
+/** Removes session `id` (backend invalidated it) */
+static void dns_tls_session_remove(struct dns_tls_session_cache *self,
+				   const uint8_t *id, size_t id_len)
+{
+	struct dns_tls_session *entry = _dns_tls_session_slot(self, id, id_len);
+
+	if ((entry != NULL) && (entry->id_len == id_len) &&
+	    (memcmp(entry->id, id, id_len) == 0)) {
+		entry->id_len = 0u;
+	}
+}
+
+/*****************************************************************************
+ * DNS WIRE NAME PRIMITIVES
+ *****************************************************************************/
+/* Domain names below are in uncompressed wire format: length prefixed
+ * labels ending with zero length root label, [len]text[len]text...[0].
+ * Working on wire format keeps label boundaries and saves conversion into
+ * dotted string. Label length bytes (at most 63) are never ASCII letters,
+ * so case folding can be applied to the whole name at once. */
+
+/** Maximum number of labels in a wire name (root label included) */
+#define DNS_NAME_LABELS_MAX 128u
+
+/** Loads 4 bytes (any alignment, any byte order) */
+static uint32_t _dns_load32(const uint8_t *p)
+{
+	uint32_t word;
+
+	(void)memcpy(&word, p, sizeof(word));
+
+	return word;
+}
+
+/** Folds ASCII upper case letters of 4 packed bytes into lower case */
+static uint32_t _dns_swar_lower(uint32_t x)
+{
+	uint32_t low7  = x & 0x7F7F7F7Fu;
+	uint32_t ge_a  = low7 + 0x3F3F3F3Fu; /* MSB set if byte >= 'A' */
+	uint32_t gt_z  = low7 + 0x25252525u; /* MSB set if byte >  'Z' */
+	uint32_t upper = ge_a & ~gt_z & ~x & 0x80808080u;
+
+	return x | (upper >> 2);
+}
+
+/** Returns length of wire name (root label included) found at `wire`,
+ *  or 0 if name is invalid, compressed or doesn't fit into `cap` */
+static size_t dns_name_wire_len(const uint8_t *wire, size_t cap)
+{
+	size_t result = 0u;
+	size_t ofs = 0u;
+	bool   done = false;
+
+	while (!done && (ofs < cap) && (ofs < DNS_NAME_WIRE_MAX)) {
+		uint8_t len = wire[ofs];
+
+		if (len == 0u) {
+			result = ofs + 1u;
+			done = true;
+		} else if (len > 63u) {
+			done = true; /* Compression pointer or bad label */
+		} else {
+			ofs += 1u + (size_t)len;
+		}
+	}
+
+	return result;
+}
+
+/** Collects label offsets of wire name into `ofs` (root label included).
+ *  Returns number of labels, 0 if name is invalid */
+static size_t _dns_name_labels(const uint8_t *wire, size_t len, uint8_t *ofs)
+{
+	size_t n = 0u;
+	size_t i = 0u;
+
+	while ((i < len) && (n < DNS_NAME_LABELS_MAX)) {
+		ofs[n] = (uint8_t)i;
+		n++;
+
+		if (wire[i] == 0u) {
+			i = len; /* Root label */
+		} else {
+			i += 1u + (size_t)wire[i];
+		}
+	}
+
+	return n;
+}
+
+/** Case insensitive equality of two wire names (4 bytes at a time) */
+static bool dns_name_eq(const uint8_t *a, size_t a_len,
+			const uint8_t *b, size_t b_len)
+{
+	bool result = (a_len == b_len);
+	size_t i = 0u;
+
+	while (result && ((i + 4u) <= a_len)) {
+		result = (_dns_swar_lower(_dns_load32(&a[i])) ==
+			  _dns_swar_lower(_dns_load32(&b[i])));
+		i += 4u;
+	}
+
+	while (result && (i < a_len)) {
+		result = (_dns_ascii_lower(a[i]) == _dns_ascii_lower(b[i]));
+		i++;
+	}
+
+	return result;
+}
+
+/** Returns true if `child` is `parent` or it's subdomain (case insensitive,
+ *  label boundaries respected) */
+static bool dns_name_is_subdomain(const uint8_t *child, size_t child_len,
+				  const uint8_t *parent, size_t parent_len)
+{
+	size_t ofs = 0u;
+
+	/* Skip child labels until the rest is as long as parent */
+	while ((ofs < child_len) && ((child_len - ofs) > parent_len) &&
+	       (child[ofs] != 0u)) {
+		ofs += 1u + (size_t)child[ofs];
+	}
+
+	return (ofs <= child_len) && ((child_len - ofs) == parent_len) &&
+	       dns_name_eq(&child[ofs], child_len - ofs, parent, parent_len);
+}
+
+/** Compares two wire names in DNSSEC canonical order (RFC 4034 section
+ *  6.1): label by label starting from the rightmost one, labels compared
+ *  as lower case octet strings. Returns <0, 0 or >0 like memcmp */
+static int dns_name_canonical_cmp(const uint8_t *a, size_t a_len,
+				  const uint8_t *b, size_t b_len)
+{
+	uint8_t a_ofs[DNS_NAME_LABELS_MAX];
+	uint8_t b_ofs[DNS_NAME_LABELS_MAX];
+	size_t  a_n = _dns_name_labels(a, a_len, a_ofs);
+	size_t  b_n = _dns_name_labels(b, b_len, b_ofs);
+	int     result = 0;
+
+	/* Skip root labels, then walk from the right */
+	a_n = (a_n > 0u) ? (a_n - 1u) : 0u;
+	b_n = (b_n > 0u) ? (b_n - 1u) : 0u;
+
+	while ((result == 0) && (a_n > 0u) && (b_n > 0u)) {
+		const uint8_t *la = &a[a_ofs[a_n - 1u]];
+		const uint8_t *lb = &b[b_ofs[b_n - 1u]];
+		uint8_t i = 0u;
+
+		while ((result == 0) && (i < la[0]) && (i < lb[0])) {
+			result = (int)_dns_ascii_lower(la[1u + i]) -
+				 (int)_dns_ascii_lower(lb[1u + i]);
+			i++;
+		}
+
+		if (result == 0) {
+			result = (int)la[0] - (int)lb[0];
+		}
+
+		a_n--;
+		b_n--;
+	}
+
+	if (result == 0) {
+		result = (int)a_n - (int)b_n;
+	}
+
+	return result;
+}
+
+/** Converts dotted name ("aaa.bbb.ccc", trailing dot optional) into wire
+ *  format. Returns wire name length, or 0 if name is invalid or doesn't
+ *  fit into `cap` */
+static size_t dns_name_from_str(const char *str, uint8_t *wire, size_t cap)
+{
+	size_t result = 0u;
+	size_t ofs = 0u; /* Offset of current label length byte */
+	size_t len = 0u; /* Length of current label */
+	size_t i = 0u;
+	bool   ok = true;
+
+	while (ok && (str[i] != '\0')) {
+		if (str[i] != '.') {
+			ok = (len < 63u) && ((ofs + 1u + len) < cap);
+
+			if (ok) {
+				wire[ofs + 1u + len] = (uint8_t)str[i];
+				len++;
+			}
+		} else if (len > 0u) {
+			wire[ofs] = (uint8_t)len;
+			ofs += 1u + len;
+			len  = 0u;
+		} else {
+			/* Empty label is allowed only as the root "." */
+			ok = (i == 0u) && (str[1] == '\0');
+		}
+
+		i++;
+	}
+
+	if (ok && (len > 0u)) {
+		wire[ofs] = (uint8_t)len;
+		ofs += 1u + len;
+	}
+
+	if (ok && (ofs < cap) && (ofs < DNS_NAME_WIRE_MAX)) {
+		wire[ofs] = 0u;
+		result = ofs + 1u;
+	}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS HOT RECORDS (FAST PATH)
+ *****************************************************************************/
+/** Class IN */
+#define DNS_CLASS_IN 1u
+
+/** Compression pointer to QNAME (it always starts at offset 12) */
+#define DNS_PTR_QNAME 0xC00Cu
+
+/** Maximum QNAME length in wire format `struct dns_msg` can parse */
+#define DNS_QNAME_WIRE_MAX 65u
+
+/** Maximum hot record RDATA length (fits AAAA) */
+#define DNS_HOT_RDATA_MAX 16u
+
+/** Maximum hot record RR length: pointer, type, class, ttl, rdlen, rdata */
+#define DNS_HOT_RR_MAX (12u + DNS_HOT_RDATA_MAX)
+
+/** Builds class IN answer RR owned by QNAME (compression pointer instead of
+ *  name), so it can be appended to any query by `dns_msg_add_answer`
+ *  without encoding. Returns RR length, 0 if it doesn't fit */
+static size_t dns_rr_build(uint8_t *rr, size_t cap, uint16_t type,
+			   uint32_t ttl_s, const uint8_t *rdata,
+			   uint16_t rdlen)
+{
+	size_t result = 12u + (size_t)rdlen;
+
+	if (result > cap) {
+		result = 0u;
+	} else {
+		rr[0]  = (uint8_t)(DNS_PTR_QNAME >> 8);
+		rr[1]  = (uint8_t)(DNS_PTR_QNAME >> 0);
+		rr[2]  = (uint8_t)(type >> 8);
+		rr[3]  = (uint8_t)(type >> 0);
+		rr[4]  = (uint8_t)(DNS_CLASS_IN >> 8);
+		rr[5]  = (uint8_t)(DNS_CLASS_IN >> 0);
+		rr[6]  = (uint8_t)(ttl_s >> 24);
+		rr[7]  = (uint8_t)(ttl_s >> 16);
+		rr[8]  = (uint8_t)(ttl_s >> 8);
+		rr[9]  = (uint8_t)(ttl_s >> 0);
+		rr[10] = (uint8_t)(rdlen >> 8);
+		rr[11] = (uint8_t)(rdlen >> 0);
+
+		if (rdlen > 0u) {
+			(void)memcpy(&rr[12], rdata, rdlen);
+		}
+	}
+
+	return result;
+}
+
+/** Hot record entry. Plain data without pointers, so a table is copied as
+ *  is into the map of the driver level (XDP) responder
+ *  (dns_tools.xdp.bpf.c) */
+struct dns_hot_entry {
+	uint32_t hash;     /**< `dns_name_hash` of the name */
+	uint16_t type;     /**< Record type */
+	uint8_t  name_len; /**< Wire name length, 0 marks empty entry */
+	uint8_t  rr_len;   /**< Precompiled answer RR length */
+
+	uint8_t name[DNS_QNAME_WIRE_MAX]; /**< Lowercase wire name */
+	uint8_t rr[DNS_HOT_RR_MAX];       /**< Precompiled answer RR */
+};
+
+/** Table of hot static records (top-N A/AAAA) answered straight from the
+ *  parse buffer with precompiled RRs, before any zone lookup. Everything
+ *  else is punted to the regular path. Open addressing, linear probing */
+struct dns_hot_table {
+	struct dns_hot_entry *_entries; /**< Entries (caller storage) */
+	uint32_t _cap; /**< Number of entries, power of two */
+	uint32_t len;  /**< Number of used entries */
+
+	uint32_t hits;   /**< Queries answered */
+	uint32_t misses; /**< Queries punted */
+
+	/** Set to __LINE__ if something is not right */
+	uint32_t malformed;
+};
+
+/** Initializes hot table. `cap` must be power of two */
+static void dns_hot_init(struct dns_hot_table *self,
+			 struct dns_hot_entry *entries, uint32_t cap)
+{
+	uint32_t i;
+
+	self->_entries = entries;
+	self->_cap     = cap;
+	self->len      = 0u;
+
+	self->hits   = 0u;
+	self->misses = 0u;
+
+	self->malformed = 0u;
+
+	if ((entries == NULL) || (cap == 0u) || ((cap & (cap - 1u)) != 0u)) {
+		self->malformed = __LINE__;
+		self->_cap = 0u;
+	}
+
+	for (i = 0u; i < self->_cap; i++) {
+		self->_entries[i].name_len = 0u;
+	}
+}
+
+/** Finds entry slot for name and type. Returns free slot if not found,
+ *  or `_cap` if table is full */
+static uint32_t _dns_hot_find(const struct dns_hot_table *self,
+			      uint32_t hash, uint16_t type,
+			      const uint8_t *name, size_t len)
+{
+	uint32_t mask = self->_cap - 1u;
+	uint32_t slot = hash & mask;
+	uint32_t result = self->_cap;
+	uint32_t n;
+
+	for (n = 0u; (n < self->_cap) && (result == self->_cap); n++) {
+		const struct dns_hot_entry *e = &self->_entries[slot];
+
+		if ((e->name_len == 0u) ||
+		    ((e->hash == hash) && (e->type == type) &&
+		     dns_name_eq(e->name, e->name_len, name, len))) {
+			result = slot;
+		}
+
+		slot = (slot + 1u) & mask;
+	}
+
+	return result;
+}
+
+/** Adds (or replaces) hot record. `name` is wire format name.
+ *  Returns true on success */
+static bool dns_hot_add(struct dns_hot_table *self, const uint8_t *name,
+			size_t name_len, uint16_t type, uint32_t ttl_s,
+			const uint8_t *rdata, uint16_t rdlen)
+{
+	bool result = false;
+	uint32_t hash = dns_name_hash(name, name_len);
+	uint32_t slot = self->_cap;
+	struct dns_hot_entry *e;
+	size_t i;
+
+	if ((self->_cap > 0u) && (name_len > 0u) &&
+	    (name_len <= DNS_QNAME_WIRE_MAX) &&
+	    (rdlen <= DNS_HOT_RDATA_MAX)) {
+		slot = _dns_hot_find(self, hash, type, name, name_len);
+	}
+
+	if (slot >= self->_cap) {
+		self->malformed = __LINE__;
+	} else {
+		e = &self->_entries[slot];
+
+		if (e->name_len == 0u) {
+			self->len++;
+		}
+
+		e->hash     = hash;
+		e->type     = type;
+		e->name_len = (uint8_t)name_len;
+		e->rr_len   = (uint8_t)dns_rr_build(e->rr, sizeof(e->rr),
+						    type, ttl_s, rdata,
+						    rdlen);
+
+		for (i = 0u; i < name_len; i++) {
+			e->name[i] = _dns_ascii_lower(name[i]);
+		}
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Answers parsed query from hot table. Returns answer length (raw UDP
+ *  payload length), or 0 if query should go through regular path */
+static size_t dns_hot_answer(struct dns_hot_table *self, struct dns_msg *msg)
+{
+	size_t result = 0u;
+	const uint8_t *qname = &msg->_packet_buf[12];
+	uint32_t slot = self->_cap;
+
+	if ((self->len > 0u) && (msg->malformed == 0u) &&
+	    (msg->query_class == DNS_CLASS_IN)) {
+		slot = _dns_hot_find(self, dns_msg_qname_hash(msg),
+				     msg->query_type, qname, msg->_qname_len);
+	}
+
+	if ((slot < self->_cap) && (self->_entries[slot].name_len > 0u)) {
+		result = dns_msg_add_answer(msg, self->_entries[slot].rr,
+					    self->_entries[slot].rr_len);
+	}
+
+	if (result > 0u) {
+		self->hits++;
+	} else {
+		self->misses++;
+	}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS BUSY POLLING
+ *****************************************************************************/
+/** Adaptive backoff for busy polling workers on dedicated cores. Worker
+ *  spins on non-blocking receive (recvmmsg with MSG_DONTWAIT, SO_BUSY_POLL
+ *  sockets) instead of sleeping in epoll, which removes wakeup latency and
+ *  jitter. After `spin_max` empty polls it starts pausing, doubling pause
+ *  up to `pause_max_us`, and snaps back to spinning on first packet */
+struct dns_busy_poll {
+	uint32_t spin_max;     /**< Empty polls before backing off */
+	uint32_t pause_max_us; /**< Maximum pause between polls */
+
+	uint32_t _idle; /**< Consecutive empty polls */
+
+	/** Pause before next poll (0 means poll again right away) */
+	uint32_t pause_us;
+
+	uint32_t polls; /**< Number of polls */
+	uint32_t empty; /**< Number of empty polls */
+};
+
+/** Initializes busy polling backoff */
+static void dns_busy_poll_init(struct dns_busy_poll *self, uint32_t spin_max,
+			       uint32_t pause_max_us)
+{
+	self->spin_max     = spin_max;
+	self->pause_max_us = pause_max_us;
+
+	self->_idle    = 0u;
+	self->pause_us = 0u;
+
+	self->polls = 0u;
+	self->empty = 0u;
+}
+
+/** Reports number of packets received by the last poll. Returns pause
+ *  (in us) before the next poll, 0 means poll again right away */
+static uint32_t dns_busy_poll_update(struct dns_busy_poll *self,
+				     uint32_t packets)
+{
+	self->polls++;
+
+	if (packets > 0u) {
+		self->_idle    = 0u;
+		self->pause_us = 0u;
+	} else {
+		self->empty++;
+
+		if (self->_idle < UINT32_MAX) {
+			self->_idle++;
+		}
+
+		if (self->_idle <= self->spin_max) {
+			self->pause_us = 0u;
+		} else if (self->pause_us == 0u) {
+			self->pause_us = 1u;
+		} else if (self->pause_us < (self->pause_max_us / 2u)) {
+			self->pause_us *= 2u;
+		} else {
+			self->pause_us = self->pause_max_us;
+		}
+
+		/* First pause may exceed a maximum of 0 (pausing disabled) */
+		if (self->pause_us > self->pause_max_us) {
+			self->pause_us = self->pause_max_us;
+		}
+	}
+
+	return self->pause_us;
+}
+
+/*****************************************************************************
+ * DNS 0x20 CASE RANDOMISATION
+ *****************************************************************************/
+/* QNAME case is preserved by design: `name` keeps the case client sent and
+ * answers refer to the QNAME bytes in the buffer by compression pointer,
+ * while lookups (`dns_msg_qname_hash`, hot table) fold case. Forwarders
+ * additionally randomise QNAME case of upstream queries (draft-vixie-dnsext
+ * -dns0x20) and only accept replies echoing it bit for bit. */
+
+/** Returns next xorshift32 pseudo random number. `state` must be nonzero */
+static uint32_t dns_rand(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	*state = x;
+
+	return x;
+}
+
+/** Randomises case of QNAME letters in the message buffer (in place),
+ *  before the query is forwarded upstream. `name` keeps original case */
+static void dns_msg_0x20_randomize(struct dns_msg *self, uint32_t *rng)
+{
+	uint8_t *p = &self->_packet_buf[12];
+	uint32_t bits = 0u;
+	uint8_t  nbits = 0u;
+	uint8_t  i;
+
+	for (i = 0u; (self->malformed == 0u) && (i < self->_qname_len); i++) {
+		uint8_t c = _dns_ascii_lower(p[i]);
+
+		/* Letters only, label length bytes are never letters
+		 * (maximum label length here is 63) */
+		if ((c >= (uint8_t)'a') && (c <= (uint8_t)'z')) {
+			if (nbits == 0u) {
+				bits  = dns_rand(rng);
+				nbits = 32u;
+			}
+
+			p[i] = ((bits & 1u) != 0u) ? (uint8_t)(c - 0x20u) : c;
+
+			bits >>= 1;
+			nbits--;
+		}
+	}
+}
+
+/** Verifies upstream reply against the (randomised) query held by `self`:
+ *  response (QR set), same ID, single question, QNAME echoed exactly (case
+ *  included), same QTYPE and QCLASS */
+static bool dns_msg_0x20_verify(struct dns_msg *self, const uint8_t *reply,
+				size_t reply_len)
+{
+	const uint8_t *q = self->_packet_buf;
+	size_t question_len = (size_t)self->_qname_len + 4u;
+	bool result = (self->malformed == 0u) &&
+		      (reply_len >= (12u + question_len)) &&
+		      (reply[0] == q[0]) && (reply[1] == q[1]) &&
+		      ((reply[2] & 0x80u) != 0u) &&
+		      (reply[4] == 0u) && (reply[5] == 1u);
+
+	if (result) {
+		result = (memcmp(&reply[12], &q[12], question_len) == 0);
+	}
+
+	return result;
+}
+
+/** Restores QNAME case of verified reply to the case client sent, so the
+ *  reply echoes client query exactly */
+static void dns_msg_0x20_restore(struct dns_msg *self, uint8_t *reply)
+{
+	uint8_t ofs = 0u;
+	uint8_t idx = 0u;
+	uint8_t len;
+	uint8_t j;
+
+	while ((ofs < self->_qname_len) && (reply[12u + ofs] != 0u)) {
+		len = reply[12u + ofs];
+
+		for (j = 0u; (j < len) && (idx < self->_name_len); j++) {
+			reply[12u + ofs + 1u + j] = (uint8_t)self->name[idx];
+			idx++;
+		}
+
+		idx++; /* Skip dot */
+		ofs = (uint8_t)(ofs + 1u + len);
+	}
+}
+
+/*****************************************************************************
+ * DNS ORDERED NAME INDEX (NSEC)
+ *****************************************************************************/
+/** Marks missing entry */
+#define DNS_INDEX_NONE 0xFFFFFFFFu
+
+/** Maximum canonical key length (every label octet may take two bytes) */
+#define DNS_NAME_KEY_MAX (2u * DNS_NAME_WIRE_MAX)
+
+/** Keys per B+tree node (node is 64 bytes, a cache line) */
+#define DNS_NAME_INDEX_KEYS 7u
+
+/** Maximum B+tree depth (far more than 2^32 entries need) */
+#define DNS_NAME_INDEX_DEPTH 24u
+
+/** Converts wire name into canonical key: labels from the rightmost one,
+ *  lower cased, each ended with 0x00 (octets 0x00 and 0x01 are escaped as
+ *  0x01 0x01 and 0x01 0x02). Keys compared with memcmp (shorter first on
+ *  tie) are in DNSSEC canonical order. Returns key length, 0 if name is
+ *  invalid */
+static size_t _dns_name_key(const uint8_t *name, size_t name_len,
+			    uint8_t *key)
+{
+	uint8_t ofs[DNS_NAME_LABELS_MAX];
+	size_t  n = _dns_name_labels(name, name_len, ofs);
+	size_t  result = 0u;
+	size_t  i;
+	uint8_t c;
+
+	/* Root label must be the last byte */
+	if ((n == 0u) || ((size_t)ofs[n - 1u] != (name_len - 1u)) ||
+	    (name[name_len - 1u] != 0u)) {
+		n = 0u;
+	} else {
+		n--;
+	}
+
+	while (n > 0u) {
+		const uint8_t *label = &name[ofs[n - 1u]];
+
+		for (i = 1u; i <= label[0]; i++) {
+			c = _dns_ascii_lower(label[i]);
+
+			if (c < 2u) {
+				key[result] = 1u;
+				result++;
+				c++;
+			}
+
+			key[result] = c;
+			result++;
+		}
+
+		key[result] = 0u;
+		result++;
+		n--;
+	}
+
+	/* Root name gets key 0x00 (length 1), apart from invalid names (0) */
+	if ((name_len == 1u) && (name[0] == 0u)) {
+		key[0] = 0u;
+		result = 1u;
+	}
+
+	return result;
+}
+
+/** Ordered index entry. Canonical key is kept by the index itself */
+struct dns_name_index_entry {
+	uint32_t key_ofs; /**< Offset of canonical key in key storage */
+	uint16_t key_len; /**< Canonical key length */
+	uint32_t value;   /**< Caller value (node or RRset id) */
+};
+
+/** B+tree node. Leaves hold entry ids in order, inner nodes hold entry ids
+ *  of separators and children: every key of child `i + 1` is greater than
+ *  or equal to `key[i]` */
+struct dns_name_index_node {
+	uint16_t len;  /**< Number of keys */
+	uint16_t leaf; /**< Nonzero if node is a leaf */
+
+	uint32_t key[DNS_NAME_INDEX_KEYS];        /**< Entry ids */
+	uint32_t child[DNS_NAME_INDEX_KEYS + 1u]; /**< Children (inner only) */
+};
+
+/** Index of names in DNSSEC canonical order, kept next to hash lookups to
+ *  answer "closest preceding name" (NSEC denial of existence, finding
+ *  enclosing delegation). B+tree of cache line nodes over caller storage,
+ *  names are inserted one by one and lookups are valid after every insert.
+ *  Names are stored as canonical keys, a query name is converted once and
+ *  then compared with plain memcmp on every level. Storage needed for
+ *  `cap` names: `cap` entries, at most `cap / 3 + 16` nodes and key bytes
+ *  about the total of wire name lengths */
+struct dns_name_index {
+	struct dns_name_index_entry *_entries; /**< Entries (caller storage) */
+	uint32_t _cap; /**< Entries capacity */
+	uint32_t len;  /**< Number of entries */
+
+	struct dns_name_index_node *_nodes; /**< Nodes (caller storage) */
+	uint32_t _nodes_cap; /**< Nodes capacity */
+	uint32_t nodes_len;  /**< Number of used nodes */
+
+	uint8_t *_keys;     /**< Canonical keys (caller storage) */
+	uint32_t _keys_cap; /**< Key storage size */
+	uint32_t keys_len;  /**< Used key storage */
+
+	uint32_t _root; /**< Root node, DNS_INDEX_NONE if empty */
+
+	/** Set to __LINE__ if something is not right */
+	uint32_t malformed;
+};
+
+/** Initializes empty index */
+static void dns_name_index_init(struct dns_name_index *self,
+				struct dns_name_index_entry *entries,
+				uint32_t cap,
+				struct dns_name_index_node *nodes,
+				uint32_t nodes_cap,
+				uint8_t *keys, uint32_t keys_cap)
+{
+	self->_entries = entries;
+	self->_cap     = (entries != NULL) ? cap : 0u;
+	self->len      = 0u;
+
+	self->_nodes     = nodes;
+	self->_nodes_cap = (nodes != NULL) ? nodes_cap : 0u;
+	self->nodes_len  = 0u;
+
+	self->_keys     = keys;
+	self->_keys_cap = (keys != NULL) ? keys_cap : 0u;
+	self->keys_len  = 0u;
+
+	self->_root = DNS_INDEX_NONE;
+
+	self->malformed = 0u;
+}
+
+/** Compares key of entry `id` with `key`. Returns <0, 0 or >0 */
+static int _dns_name_index_cmp(const struct dns_name_index *self,
+			       uint32_t id, const uint8_t *key, size_t key_len)
+{
+	const struct dns_name_index_entry *e = &self->_entries[id];
+	size_t len = (e->key_len < key_len) ? e->key_len : key_len;
+	int result = memcmp(&self->_keys[e->key_ofs], key, len);
+
+	if (result == 0) {
+		result = (int)e->key_len - (int)key_len;
+	}
+
+	return result;
+}
+
+/** Returns number of keys of node `n` less than or equal to `key` */
+static uint32_t _dns_name_index_upper(const struct dns_name_index *self,
+				      uint32_t n, const uint8_t *key,
+				      size_t key_len)
+{
+	const struct dns_name_index_node *node = &self->_nodes[n];
+	uint32_t lo = 0u;
+	uint32_t hi = node->len;
+	uint32_t mid;
+
+	while (lo < hi) {
+		mid = lo + ((hi - lo) / 2u);
+
+		if (_dns_name_index_cmp(self, node->key[mid], key,
+					key_len) <= 0) {
+			lo = mid + 1u;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/** Takes empty node */
+static uint32_t _dns_name_index_node(struct dns_name_index *self, bool leaf)
+{
+	struct dns_name_index_node *node = &self->_nodes[self->nodes_len];
+	uint32_t i;
+
+	node->len  = 0u;
+	node->leaf = leaf ? 1u : 0u;
+
+	for (i = 0u; i < (DNS_NAME_INDEX_KEYS + 1u); i++) {
+		node->child[i] = DNS_INDEX_NONE;
+	}
+
+	self->nodes_len++;
+
+	return self->nodes_len - 1u;
+}
+
+/** Inserts entry `id` at `pos` of leaf `n`, splitting full nodes up the
+ *  `depth` long descent `path` (`slot` is the child taken at each level).
+ *  Caller makes sure there are `depth + 2` free nodes */
+static void _dns_name_index_insert(struct dns_name_index *self,
+				   const uint32_t *path, const uint8_t *slot,
+				   uint32_t depth, uint32_t n, uint32_t pos,
+				   uint32_t id)
+{
+	uint32_t key[DNS_NAME_INDEX_KEYS + 1u];
+	uint32_t child[DNS_NAME_INDEX_KEYS + 2u];
+	uint32_t half = (DNS_NAME_INDEX_KEYS + 1u) / 2u;
+	uint32_t right = DNS_INDEX_NONE; /* Right child of `id` (inner) */
+	uint32_t m;
+	uint32_t i;
+	struct dns_name_index_node *node;
+	struct dns_name_index_node *sibling;
+	bool done = false;
+
+	while (!done) {
+		node = &self->_nodes[n];
+
+		/* Keys and children with the new ones in place */
+		for (i = 0u; i <= node->len; i++) {
+			key[i] = (i < pos) ? node->key[i] :
+				 ((i == pos) ? id : node->key[i - 1u]);
+		}
+
+		for (i = 0u; i <= (node->len + 1u); i++) {
+			child[i] = (i <= pos) ? node->child[i] :
+				   ((i == (pos + 1u)) ? right :
+				    node->child[i - 1u]);
+		}
+
+		if (node->len < DNS_NAME_INDEX_KEYS) {
+			node->len++;
+			(void)memcpy(node->key, key, node->len * sizeof(key[0]));
+			(void)memcpy(node->child, child,
+				     (node->len + 1u) * sizeof(child[0]));
+			done = true;
+		} else {
+			/* Split, upper half moves into new sibling */
+			m = _dns_name_index_node(self, node->leaf != 0u);
+			node = &self->_nodes[n];
+			sibling = &self->_nodes[m];
+
+			node->len = (uint16_t)half;
+			(void)memcpy(node->key, key, half * sizeof(key[0]));
+			(void)memcpy(node->child, child,
+				     (half + 1u) * sizeof(child[0]));
+
+			/* Leaf keeps separator as it's first key */
+			i = (node->leaf != 0u) ? half : (half + 1u);
+			sibling->len = (uint16_t)((DNS_NAME_INDEX_KEYS + 1u) - i);
+			(void)memcpy(sibling->key, &key[i],
+				     sibling->len * sizeof(key[0]));
+
+			if (node->leaf == 0u) {
+				(void)memcpy(sibling->child, &child[i],
+					     (sibling->len + 1u) *
+					     sizeof(child[0]));
+			}
+
+			id    = key[half];
+			right = m;
+
+			if (depth == 0u) {
+				/* Root split, tree grows by one level */
+				self->_root = _dns_name_index_node(self, false);
+				node = &self->_nodes[self->_root];
+				node->len      = 1u;
+				node->key[0]   = id;
+				node->child[0] = n;
+				node->child[1] = m;
+				done = true;
+			} else {
+				depth--;
+				n   = path[depth];
+				pos = slot[depth];
+			}
+		}
+	}
+}
+
+/** Inserts name, lookups see it right away. Inserting the same name
+ *  again replaces it's value. Returns true on success */
+static bool dns_name_index_add(struct dns_name_index *self,
+			       const uint8_t *name, size_t name_len,
+			       uint32_t value)
+{
+	uint8_t  key[DNS_NAME_KEY_MAX];
+	uint32_t path[DNS_NAME_INDEX_DEPTH];
+	uint8_t  slot[DNS_NAME_INDEX_DEPTH];
+	size_t   key_len = 0u;
+	uint32_t depth = 0u;
+	uint32_t n = self->_root;
+	uint32_t pos = 0u;
+	uint32_t id;
+	struct dns_name_index_entry *e;
+	bool     result = false;
+
+	if ((name_len > 0u) && (name_len <= DNS_NAME_WIRE_MAX)) {
+		key_len = _dns_name_key(name, name_len, key);
+	}
+
+	if (key_len == 0u) {
+		n = DNS_INDEX_NONE;
+	}
+
+	/* Descend to leaf remembering the path for splits */
+	while ((n != DNS_INDEX_NONE) && (self->_nodes[n].leaf == 0u) &&
+	       (depth < DNS_NAME_INDEX_DEPTH)) {
+		pos = _dns_name_index_upper(self, n, key, key_len);
+
+		path[depth] = n;
+		slot[depth] = (uint8_t)pos;
+		depth++;
+
+		n = self->_nodes[n].child[pos];
+	}
+
+	if (n != DNS_INDEX_NONE) {
+		pos = _dns_name_index_upper(self, n, key, key_len);
+	}
+
+	if (key_len == 0u) {
+		self->malformed = __LINE__;
+	} else if ((pos > 0u) &&
+		   (_dns_name_index_cmp(self, self->_nodes[n].key[pos - 1u],
+					key, key_len) == 0)) {
+		/* Same name, replace in place */
+		self->_entries[self->_nodes[n].key[pos - 1u]].value = value;
+		result = true;
+	} else if ((self->len >= self->_cap) ||
+		   ((self->_keys_cap - self->keys_len) < key_len) ||
+		   ((self->_nodes_cap - self->nodes_len) < (depth + 2u)) ||
+		   (depth >= DNS_NAME_INDEX_DEPTH)) {
+		/* No room, index is left untouched */
+		self->malformed = __LINE__;
+	} else {
+		id = self->len;
+		e  = &self->_entries[id];
+
+		e->key_ofs = self->keys_len;
+		e->key_len = (uint16_t)key_len;
+		e->value   = value;
+		(void)memcpy(&self->_keys[e->key_ofs], key, key_len);
+
+		self->keys_len += (uint32_t)key_len;
+		self->len++;
+
+		if (n == DNS_INDEX_NONE) {
+			n = _dns_name_index_node(self, true);
+			self->_root = n;
+		}
+
+		_dns_name_index_insert(self, path, slot, depth, n, pos, id);
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Finds entry with the greatest name less than or equal to `name`
+ *  (canonical order). If `name` precedes every entry, last entry is
+ *  returned, as NSEC chain wraps around. Returns entry id, or
+ *  DNS_INDEX_NONE if index is empty or name is invalid */
+static uint32_t dns_name_index_find_le(const struct dns_name_index *self,
+				       const uint8_t *name, size_t name_len)
+{
+	uint8_t  key[DNS_NAME_KEY_MAX];
+	size_t   key_len = 0u;
+	uint32_t n = self->_root;
+	uint32_t pos = 0u;
+	uint32_t result = DNS_INDEX_NONE;
+
+	if ((name_len > 0u) && (name_len <= DNS_NAME_WIRE_MAX)) {
+		key_len = _dns_name_key(name, name_len, key);
+	}
+
+	if (key_len == 0u) {
+		n = DNS_INDEX_NONE;
+	}
+
+	while ((n != DNS_INDEX_NONE) && (self->_nodes[n].leaf == 0u)) {
+		n = self->_nodes[n].child[_dns_name_index_upper(self, n, key,
+								key_len)];
+	}
+
+	if (n != DNS_INDEX_NONE) {
+		pos = _dns_name_index_upper(self, n, key, key_len);
+	}
+
+	if (pos > 0u) {
+		result = self->_nodes[n].key[pos - 1u];
+	} else if (n != DNS_INDEX_NONE) {
+		/* Precedes every name, wrap around to the last one */
+		n = self->_root;
+
+		while (self->_nodes[n].leaf == 0u) {
+			n = self->_nodes[n].child[self->_nodes[n].len];
+		}
+
+		result = self->_nodes[n].key[self->_nodes[n].len - 1u];
+	} else {}
+
+	return result;
+}
+
+/** Returns entry by id (NULL if out of range) */
+static const struct dns_name_index_entry *
+dns_name_index_get(const struct dns_name_index *self, uint32_t idx)
+{
+	const struct dns_name_index_entry *result = NULL;
+
+	if (idx < self->len) {
+		result = &self->_entries[idx];
+	}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS SUFFIX TREE
+ *****************************************************************************/
+/** Virtual root node index (root node is not stored) */
+#define DNS_SUFFIX_ROOT 0xFFFFFFFEu
+
+/** Suffix tree node flags */
+#define DNS_SUFFIX_USED 0x01u /**< Node slot is in use */
+#define DNS_SUFFIX_TERM 0x02u /**< Name ending here was inserted */
+#define DNS_SUFFIX_WILD 0x10u /**< Wildcard ("*") child was inserted */
+
+/** Suffix tree node, one per label. Plain data with indices instead of
+ *  pointers, so the whole tree can be saved and mapped back as is */
+struct dns_suffix_node {
+	uint32_t parent;    /**< Parent node, DNS_SUFFIX_ROOT for TLDs */
+	uint32_t child;     /**< First child, DNS_INDEX_NONE if leaf */
+	uint32_t next;      /**< Next sibling, DNS_INDEX_NONE if last */
+	uint32_t label_ofs; /**< Label offset in label pool (lower case) */
+	uint32_t value;     /**< Caller value of inserted name */
+
+	uint8_t label_len; /**< Label length */
+	uint8_t depth;     /**< Number of labels from root (TLD is 1) */
+	uint8_t flags;     /**< DNS_SUFFIX_* */
+	uint8_t _reserved; /**< Keeps layout explicit */
+};
+
+/** Name tree keyed on reversed label sequence (TLD first). A single walk
+ *  from the rightmost label answers exact, longest suffix and subtree
+ *  (every name under a suffix) lookups, so zone lookup, delegation finding
+ *  and blocklist matching share one structure.
+ *
+ *  Children are found through hashing (parent, label) into the node array
+ *  (open addressing), so fan-out doesn't matter: a node with a million
+ *  children costs one probe like a node with one. Sibling links are kept
+ *  for subtree walks (in no particular order, `dns_name_index` is there for
+ *  canonical order). Nodes and labels live in caller storage */
+struct dns_suffix_tree {
+	struct dns_suffix_node *_nodes; /**< Nodes (caller storage) */
+	uint32_t _cap; /**< Node capacity, power of two */
+	uint32_t len;  /**< Number of used nodes */
+
+	uint8_t *_labels;     /**< Label pool (caller storage) */
+	uint32_t _labels_cap; /**< Label pool capacity */
+	uint32_t labels_len;  /**< Used label pool bytes */
+
+	/** First child of the (virtual) root */
+	uint32_t _root_child;
+
+	/** Set to __LINE__ if something is not right */
+	uint32_t malformed;
+};
+
+/** Initializes empty tree. `cap` must be power of two */
+static void dns_suffix_tree_init(struct dns_suffix_tree *self,
+				 struct dns_suffix_node *nodes, uint32_t cap,
+				 uint8_t *labels, uint32_t labels_cap)
+{
+	uint32_t i;
+
+	self->_nodes = nodes;
+	self->_cap   = cap;
+	self->len    = 0u;
+
+	self->_labels     = labels;
+	self->_labels_cap = labels_cap;
+	self->labels_len  = 0u;
+
+	self->_root_child = DNS_INDEX_NONE;
+
+	self->malformed = 0u;
+
+	if ((nodes == NULL) || (labels == NULL) || (cap == 0u) ||
+	    ((cap & (cap - 1u)) != 0u)) {
+		self->malformed = __LINE__;
+		self->_cap = 0u;
+	}
+
+	for (i = 0u; i < self->_cap; i++) {
+		self->_nodes[i].flags = 0u;
+	}
+}
+
+/** Hashes (parent, label). `label` points to label length byte */
+static uint32_t _dns_suffix_hash(uint32_t parent, const uint8_t *label)
+{
+	uint32_t hash = dns_name_hash(label, 1u + (size_t)label[0]);
+
+	hash ^= parent;
+	hash *= DNS_HASH_PRIME;
+
+	return hash ^ (hash >> 16);
+}
+
+/** Finds child of `parent` with `label` (points to label length byte).
+ *  Returns child index, or free slot with DNS_SUFFIX_USED unset if child
+ *  doesn't exist, or DNS_INDEX_NONE if tree is full */
+static uint32_t _dns_suffix_find(const struct dns_suffix_tree *self,
+				 uint32_t parent, const uint8_t *label)
+{
+	uint32_t mask = self->_cap - 1u;
+	uint32_t slot = _dns_suffix_hash(parent, label) & mask;
+	uint32_t result = DNS_INDEX_NONE;
+	uint32_t n;
+
+	for (n = 0u; (n < self->_cap) && (result == DNS_INDEX_NONE); n++) {
+		const struct dns_suffix_node *node = &self->_nodes[slot];
+
+		if (((node->flags & DNS_SUFFIX_USED) == 0u) ||
+		    ((node->parent == parent) &&
+		     dns_name_eq(&self->_labels[node->label_ofs],
+				 node->label_len, &label[1], label[0]))) {
+			result = slot;
+		}
+
+		slot = (slot + 1u) & mask;
+	}
+
+	return result;
+}
+
+/** Returns child of `parent` with `label` (points to label length byte),
+ *  DNS_INDEX_NONE if there is no such child */
+static uint32_t dns_suffix_tree_child(const struct dns_suffix_tree *self,
+				      uint32_t parent, const uint8_t *label)
+{
+	uint32_t result = DNS_INDEX_NONE;
+
+	if (self->len > 0u) {
+		result = _dns_suffix_find(self, parent, label);
+	}
+
+	if ((result != DNS_INDEX_NONE) &&
+	    ((self->_nodes[result].flags & DNS_SUFFIX_USED) == 0u)) {
+		result = DNS_INDEX_NONE;
+	}
+
+	return result;
+}
+
+/** Creates child of `parent` in free `slot` */
+static void _dns_suffix_add_child(struct dns_suffix_tree *self,
+				  uint32_t parent, uint32_t slot,
+				  const uint8_t *label)
+{
+	struct dns_suffix_node *node = &self->_nodes[slot];
+	uint8_t i;
+
+	node->parent    = parent;
+	node->child     = DNS_INDEX_NONE;
+	node->label_ofs = self->labels_len;
+	node->value     = 0u;
+	node->label_len = label[0];
+	node->_reserved = 0u;
+
+	for (i = 0u; i < label[0]; i++) {
+		self->_labels[self->labels_len] = _dns_ascii_lower(label[1u + i]);
+		self->labels_len++;
+	}
+
+	/* Link as first child of parent */
+	if (parent == DNS_SUFFIX_ROOT) {
+		node->depth = 1u;
+		node->next  = self->_root_child;
+		self->_root_child = slot;
+	} else {
+		node->depth = (uint8_t)(self->_nodes[parent].depth + 1u);
+		node->next  = self->_nodes[parent].child;
+		self->_nodes[parent].child = slot;
+	}
+
+	/* Slot is taken once node is complete */
+	node->flags = DNS_SUFFIX_USED;
+
+	self->len++;
+}
+
+/** Inserts wire name (or updates it's value). Intermediate labels become
+ *  plain nodes, last label gets DNS_SUFFIX_TERM, parent of "*" label gets
+ *  DNS_SUFFIX_WILD. Returns node index of the name, DNS_INDEX_NONE on
+ *  failure (root name can't be inserted) */
+static uint32_t dns_suffix_tree_insert(struct dns_suffix_tree *self,
+				       const uint8_t *name, size_t name_len,
+				       uint32_t value)
+{
+	uint8_t  ofs[DNS_NAME_LABELS_MAX];
+	size_t   n = 0u;
+	uint32_t node = DNS_SUFFIX_ROOT;
+	uint32_t slot;
+
+	if ((self->_cap > 0u) && (dns_name_wire_len(name, name_len) ==
+				  name_len)) {
+		n = _dns_name_labels(name, name_len, ofs);
+	}
+
+	/* Skip root label, walk from the rightmost label */
+	n = (n > 0u) ? (n - 1u) : 0u;
+
+	if (n == 0u) {
+		node = DNS_INDEX_NONE;
+	}
+
+	while ((n > 0u) && (node != DNS_INDEX_NONE)) {
+		const uint8_t *label = &name[ofs[n - 1u]];
+
+		slot = _dns_suffix_find(self, node, label);
+
+		if ((slot != DNS_INDEX_NONE) &&
+		    ((self->_nodes[slot].flags & DNS_SUFFIX_USED) == 0u)) {
+			/* Keep 1/8 of slots free for short probes */
+			if ((self->len >= (self->_cap - (self->_cap / 8u))) ||
+			    ((self->_labels_cap - self->labels_len) <
+			     (uint32_t)label[0])) {
+				slot = DNS_INDEX_NONE;
+			} else {
+				_dns_suffix_add_child(self, node, slot, label);
+			}
+		}
+
+		node = slot;
+		n--;
+	}
+
+	if (node == DNS_INDEX_NONE) {
+		self->malformed = __LINE__;
+	} else {
+		self->_nodes[node].flags |= DNS_SUFFIX_TERM;
+		self->_nodes[node].value  = value;
+
+		if ((name[0] == 1u) && (name[1] == (uint8_t)'*') &&
+		    (self->_nodes[node].parent != DNS_SUFFIX_ROOT)) {
+			self->_nodes[self->_nodes[node].parent].flags |=
+				DNS_SUFFIX_WILD;
+		}
+	}
+
+	return node;
+}
+
+/** Walks wire name from the rightmost label as deep as the tree goes.
+ *  Returns deepest node having any of `flags` (DNS_INDEX_NONE if none)
+ *  and stores number of matched labels into `depth` (may be NULL) */
+static uint32_t dns_suffix_tree_longest(const struct dns_suffix_tree *self,
+					const uint8_t *name, size_t name_len,
+					uint8_t flags, uint8_t *depth)
+{
+	uint8_t  ofs[DNS_NAME_LABELS_MAX];
+	size_t   n = _dns_name_labels(name, name_len, ofs);
+	uint32_t node = DNS_SUFFIX_ROOT;
+	uint32_t result = DNS_INDEX_NONE;
+	uint8_t  matched = 0u;
+
+	n = (n > 0u) ? (n - 1u) : 0u;
+
+	while ((n > 0u) && (node != DNS_INDEX_NONE)) {
+		node = dns_suffix_tree_child(self, node, &name[ofs[n - 1u]]);
+
+		if (node != DNS_INDEX_NONE) {
+			matched++;
+
+			if ((self->_nodes[node].flags & flags) != 0u) {
+				result = node;
+			}
+		}
+
+		n--;
+	}
+
+	if (depth != NULL) {
+		*depth = matched;
+	}
+
+	return result;
+}
+
+/** Returns number of labels in wire name (root label excluded) */
+static uint8_t _dns_name_label_count(const uint8_t *name, size_t name_len)
+{
+	uint8_t count = 0u;
+	size_t  ofs = 0u;
+
+	while ((ofs < name_len) && (name[ofs] != 0u)) {
+		ofs += 1u + (size_t)name[ofs];
+		count++;
+	}
+
+	return count;
+}
+
+/** Exact lookup of inserted wire name. Returns node index, or
+ *  DNS_INDEX_NONE if name wasn't inserted */
+static uint32_t dns_suffix_tree_find(const struct dns_suffix_tree *self,
+				     const uint8_t *name, size_t name_len)
+{
+	uint8_t  depth = 0u;
+	uint32_t result = dns_suffix_tree_longest(self, name, name_len,
+						  DNS_SUFFIX_TERM, &depth);
+
+	/* Deepest inserted name must be the whole name */
+	if ((result != DNS_INDEX_NONE) &&
+	    ((self->_nodes[result].depth != depth) ||
+	     (_dns_name_label_count(name, name_len) != depth))) {
+		result = DNS_INDEX_NONE;
+	}
+
+	return result;
+}
+
+/** Returns true if wire name or any of it's parent domains was inserted */
+static bool dns_suffix_tree_match(const struct dns_suffix_tree *self,
+				  const uint8_t *name, size_t name_len)
+{
+	return dns_suffix_tree_longest(self, name, name_len, DNS_SUFFIX_TERM,
+				       NULL) != DNS_INDEX_NONE;
+}
+
+/** Returns node value (0 if index is invalid) */
+static uint32_t dns_suffix_tree_value(const struct dns_suffix_tree *self,
+				      uint32_t node)
+{
+	uint32_t result = 0u;
+
+	if (node < self->_cap) {
+		result = self->_nodes[node].value;
+	}
+
+	return result;
+}
+
+/** Returns next node after `node` in subtree of `top` (pre-order, no
+ *  recursion). Start with `node` = `top`. Returns DNS_INDEX_NONE when the
+ *  subtree is exhausted. `top` may be DNS_SUFFIX_ROOT (whole tree) */
+static uint32_t dns_suffix_tree_next(const struct dns_suffix_tree *self,
+				     uint32_t top, uint32_t node)
+{
+	uint32_t result = DNS_INDEX_NONE;
+	uint32_t cur = node;
+
+	if (cur == DNS_SUFFIX_ROOT) {
+		result = self->_root_child;
+	} else if (self->_nodes[cur].child != DNS_INDEX_NONE) {
+		result = self->_nodes[cur].child;
+	} else {
+		/* Climb until there is a sibling, don't leave the subtree */
+		while ((cur != top) && (cur != DNS_SUFFIX_ROOT) &&
+		       (result == DNS_INDEX_NONE)) {
+			if (self->_nodes[cur].next != DNS_INDEX_NONE) {
+				result = self->_nodes[cur].next;
+			} else {
+				cur = self->_nodes[cur].parent;
+			}
+		}
+	}
+
+	return result;
+}
+
+/** Writes wire name of `node` into `wire`. Returns wire name length, or
+ *  0 if it doesn't fit */
+static size_t dns_suffix_tree_name(const struct dns_suffix_tree *self,
+				   uint32_t node, uint8_t *wire, size_t cap)
+{
+	size_t   len = 1u; /* Root label */
+	size_t   ofs = 0u;
+	uint32_t cur = node;
+
+	while ((cur != DNS_SUFFIX_ROOT) && (cur < self->_cap)) {
+		len += 1u + (size_t)self->_nodes[cur].label_len;
+		cur  = self->_nodes[cur].parent;
+	}
+
+	if (len > cap) {
+		len = 0u;
+	} else {
+		cur = node;
+
+		while ((cur != DNS_SUFFIX_ROOT) && (cur < self->_cap)) {
+			const struct dns_suffix_node *n = &self->_nodes[cur];
+
+			wire[ofs] = n->label_len;
+			(void)memcpy(&wire[ofs + 1u],
+				     &self->_labels[n->label_ofs],
+				     n->label_len);
+
+			ofs += 1u + (size_t)n->label_len;
+			cur  = n->parent;
+		}
+
+		wire[ofs] = 0u;
+	}
+
+	return len;
+}
+
+/*****************************************************************************
+ * DNS ZONE LOOKUP
+ *****************************************************************************/
+/** Suffix tree node flags used by zone store */
+#define DNS_SUFFIX_APEX 0x04u /**< Zone apex, authoritative data below */
+#define DNS_SUFFIX_CUT  0x08u /**< Zone cut, delegation to child zone */
+
+/** Zone lookup results */
+#define DNS_ZONE_ANSWER   0u /**< Name has data (not necessarily of QTYPE) */
+#define DNS_ZONE_NODATA   1u /**< Name exists, but has no data of it's own */
+#define DNS_ZONE_REFERRAL 2u /**< Name is at or below zone cut */
+#define DNS_ZONE_WILDCARD 3u /**< Name is synthesised from wildcard */
+#define DNS_ZONE_NXDOMAIN 4u /**< Name doesn't exist */
+#define DNS_ZONE_REFUSED  5u /**< Name is not in any hosted zone */
+
+/** Wildcard label in wire format */
+static const uint8_t _dns_wildcard_label[2] = { 1u, (uint8_t)'*' };
+
+/** Adds zone name into the tree. `flags` is 0 for ordinary names,
+ *  DNS_SUFFIX_APEX for zone apex or DNS_SUFFIX_CUT for delegation point.
+ *  `value` is the caller RRset id. Returns node index (DNS_INDEX_NONE on
+ *  failure) */
+static uint32_t dns_zone_add(struct dns_suffix_tree *self, const uint8_t *name,
+			     size_t name_len, uint32_t value, uint8_t flags)
+{
+	uint32_t node = dns_suffix_tree_insert(self, name, name_len, value);
+
+	if (node != DNS_INDEX_NONE) {
+		self->_nodes[node].flags |= (uint8_t)(flags &
+			(DNS_SUFFIX_APEX | DNS_SUFFIX_CUT));
+	}
+
+	return node;
+}
+
+/** Looks up wire name and `qtype` in a single walk from the rightmost
+ *  label, instead of probing every ancestor. Returns DNS_ZONE_* and stores
+ *  into `node`:
+ *  - ANSWER, NODATA: node of the name;
+ *  - REFERRAL: node of the zone cut (owner of delegation NS);
+ *  - WILDCARD: node of the wildcard ("*" under closest encloser);
+ *  - NXDOMAIN: closest encloser (for NSEC/NSEC3 proofs);
+ *  - REFUSED: DNS_INDEX_NONE.
+ *  Tree knows names only, not their types: ANSWER means the name owns
+ *  RRsets, caller answers NODATA if none of them is of `qtype`. Hosted
+ *  child zones (apex below a cut) take precedence over the cut, except
+ *  for DS at the cut itself, which parent answers authoritatively (RFC
+ *  4035 section 3.1.4.1): ANSWER or NODATA on the cut node, whose DS RRset
+ *  is parent side data */
+static uint8_t dns_zone_lookup(const struct dns_suffix_tree *self,
+			       const uint8_t *name, size_t name_len,
+			       uint16_t qtype, uint32_t *node)
+{
+	uint8_t  ofs[DNS_NAME_LABELS_MAX];
+	size_t   n = _dns_name_labels(name, name_len, ofs);
+	uint32_t cur = DNS_SUFFIX_ROOT;
+	uint32_t next;
+	uint8_t  result = DNS_ZONE_REFUSED;
+	bool     in_zone = false;
+	bool     done = false;
+
+	*node = DNS_INDEX_NONE;
+
+	/* Skip root label, walk from the rightmost label */
+	n = (n > 0u) ? (n - 1u) : 0u;
+
+	while (!done && (n > 0u)) {
+		next = dns_suffix_tree_child(self, cur, &name[ofs[n - 1u]]);
+
+		if (next == DNS_INDEX_NONE) {
+			done = true;
+		} else {
+			uint8_t flags = self->_nodes[next].flags;
+
+			cur = next;
+			n--;
+
+			if ((n == 0u) && in_zone && (qtype == DNS_TYPE_DS) &&
+			    ((flags & DNS_SUFFIX_CUT) != 0u)) {
+				/* Parent side of the cut */
+			} else if ((flags & DNS_SUFFIX_APEX) != 0u) {
+				in_zone = true;
+			} else if (in_zone && ((flags & DNS_SUFFIX_CUT) != 0u)) {
+				result = DNS_ZONE_REFERRAL;
+				done = true;
+			} else {}
+		}
+	}
+
+	if (!in_zone) {
+		/* Not authoritative */
+	} else if (result == DNS_ZONE_REFERRAL) {
+		*node = cur;
+	} else if (n == 0u) {
+		/* Every label matched */
+		result = ((self->_nodes[cur].flags & DNS_SUFFIX_TERM) != 0u) ?
+			 DNS_ZONE_ANSWER : DNS_ZONE_NODATA;
+		*node = cur;
+	} else {
+		/* `cur` is closest encloser, try it's wildcard */
+		next = dns_suffix_tree_child(self, cur, _dns_wildcard_label);
+
+		if ((next != DNS_INDEX_NONE) &&
+		    ((self->_nodes[next].flags & DNS_SUFFIX_TERM) != 0u)) {
+			result = DNS_ZONE_WILDCARD;
+			*node = next;
+		} else {
+			result = DNS_ZONE_NXDOMAIN;
+			*node = cur;
+		}
+	}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS ZONE INDEX (MULTI-ZONE HOSTING)
+ *****************************************************************************/
+/** Adds hosted zone apex into zone index. `zone_id` selects per-zone store.
+ *  Returns node index (DNS_INDEX_NONE on failure) */
+static uint32_t dns_zone_index_add(struct dns_suffix_tree *self,
+				   const uint8_t *apex, size_t apex_len,
+				   uint32_t zone_id)
+{
+	return dns_zone_add(self, apex, apex_len, zone_id, DNS_SUFFIX_APEX);
+}
+
+/** Finds zone enclosing QNAME of parsed query among hosted zones. Walks
+ *  the zone index once from the rightmost label using label offsets the
+ *  parser already recorded, one probe per label no matter how many zones
+ *  are hosted. Returns apex node (zone id is it's value, see
+ *  `dns_suffix_tree_value`), or DNS_INDEX_NONE if zone isn't hosted.
+ *  Number of apex labels is stored into `depth` (may be NULL) */
+static uint32_t dns_zone_index_find(const struct dns_suffix_tree *self,
+				    struct dns_msg *msg, uint8_t *depth)
+{
+	const uint8_t *qname = &msg->_packet_buf[12];
+	uint32_t node = DNS_SUFFIX_ROOT;
+	uint32_t result = DNS_INDEX_NONE;
+	uint8_t  n = msg->_label_count;
+
+	if (depth != NULL) {
+		*depth = 0u;
+	}
+
+	if (msg->malformed != 0u) {
+		n = 0u;
+	}
+
+	while ((n > 0u) && (node != DNS_INDEX_NONE)) {
+		node = dns_suffix_tree_child(self, node,
+					     &qname[msg->_label_ofs[n - 1u]]);
+
+		if ((node != DNS_INDEX_NONE) &&
+		    ((self->_nodes[node].flags & DNS_SUFFIX_APEX) != 0u)) {
+			result = node;
+
+			if (depth != NULL) {
+				*depth = self->_nodes[node].depth;
+			}
+		}
+
+		n--;
+	}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS ANY MINIMISATION (RFC 8482)
+ *****************************************************************************/
+/** TTL of synthesised HINFO answer (RFC 8482 section 4.2) */
+#define DNS_ANY_HINFO_TTL_S 3789u
+
+/** Answers ANY query with a single synthesised HINFO record
+ *  (CPU "RFC8482", empty OS) instead of every RRset of the name. Call it
+ *  right after parsing, before any lookup. ANY is the classic
+ *  amplification vector, this keeps it's answer only 21 bytes longer than
+ *  the query. Returns answer length (raw UDP payload length), or 0
+ *  if query is not an IN class ANY query (the record is IN only) */
+static size_t dns_msg_answer_any(struct dns_msg *self)
+{
+	static const uint8_t hinfo[] = {
+		7u, 'R', 'F', 'C', '8', '4', '8', '2', /* CPU */
+		0u                                     /* OS  */
+	};
+	uint8_t rr[12u + sizeof(hinfo)];
+	size_t  result = 0u;
+
+	if ((self->malformed == 0u) && (self->query_type == DNS_TYPE_ANY) &&
+	    (self->query_class == DNS_CLASS_IN)) {
+		result = dns_msg_add_answer(self, rr,
+			dns_rr_build(rr, sizeof(rr), DNS_TYPE_HINFO,
+				     DNS_ANY_HINFO_TTL_S, hinfo,
+				     (uint16_t)sizeof(hinfo)));
+	}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS AMPLIFICATION GUARD
+ *****************************************************************************/
+/** Client prefix lengths the guard accounts by */
+#define DNS_AMP_PREFIX_IPV4 3u /**< /24 */
+#define DNS_AMP_PREFIX_IPV6 7u /**< /56 */
+
+/** Per client prefix byte counters */
+struct dns_amp_entry {
+	uint8_t  key[8];    /**< Family and prefix bytes, key[0] 0 if empty */
+	uint32_t window_s;  /**< Window the counters belong to */
+	uint32_t in_bytes;  /**< Query bytes received in window */
+	uint32_t out_bytes; /**< Answer bytes sent in window */
+};
+
+/** Response size amplification guard. Accounts query and answer bytes per
+ *  client prefix. Once answers to an unverified prefix (no valid cookie,
+ *  not over TCP) would exceed `ratio_max` times it's query bytes within a
+ *  window, the answer is cut to an empty truncated (TC) answer, sending
+ *  legitimate clients over TCP and starving spoofed reflection. Direct
+ *  mapped table, colliding prefix replaces the older one */
+struct dns_amp_guard {
+	struct dns_amp_entry *_entries; /**< Entries (caller storage) */
+	uint32_t _cap; /**< Number of entries */
+
+	uint32_t ratio_max; /**< Maximum answer/query bytes ratio */
+	uint32_t window_s;  /**< Accounting window length */
+
+	uint32_t truncated; /**< Number of truncated answers */
+};
+
+/** Initializes amplification guard */
+static void dns_amp_guard_init(struct dns_amp_guard *self,
+			       struct dns_amp_entry *entries, uint32_t cap,
+			       uint32_t ratio_max, uint32_t window_s)
+{
+	uint32_t i;
+
+	self->_entries = entries;
+	self->_cap     = (entries != NULL) ? cap : 0u;
+
+	self->ratio_max = ratio_max;
+	self->window_s  = (window_s > 0u) ? window_s : 1u;
+
+	self->truncated = 0u;
+
+	for (i = 0u; i < self->_cap; i++) {
+		self->_entries[i].key[0] = 0u;
+	}
+}
+
+/** Builds prefix key of address (family byte followed by prefix bytes) */
+static void _dns_amp_key(const struct dns_addr *addr, uint8_t *key)
+{
+	uint8_t len = (addr->family == DNS_ADDR_IPV4) ? DNS_AMP_PREFIX_IPV4 :
+						       DNS_AMP_PREFIX_IPV6;
+
+	(void)memset(key, 0, 8u);
+
+	key[0] = addr->family;
+	(void)memcpy(&key[1], addr->bytes, len);
+}
+
+/** Accounts answer of `answer_len` bytes (as returned by
+ *  `dns_msg_add_answer`) to query of `query_len` bytes from client in
+ *  `ctx`. `verified` is true if client address is proven (valid cookie,
+ *  TCP, DoT, DoH). `now_s` is current time. Returns true if answer must be
+ *  truncated instead (see `dns_msg_truncate`) */
+static bool dns_amp_guard_check(struct dns_amp_guard *self,
+				const struct dns_msg_ctx *ctx,
+				size_t query_len, size_t answer_len,
+				bool verified, uint32_t now_s)
+{
+	bool result = false;
+	uint8_t key[8];
+	uint32_t window_s = now_s / self->window_s;
+	struct dns_amp_entry *e;
+	uint64_t out_bytes;
+	uint64_t in_bytes;
+
+	if (!verified && (self->_cap > 0u) &&
+	    (ctx->client.family != DNS_ADDR_NONE) &&
+	    (ctx->transport == DNS_TRANSPORT_UDP)) {
+		_dns_amp_key(&ctx->client, key);
+
+		e = &self->_entries[dns_hash_bytes(key, sizeof(key)) %
+				    self->_cap];
+
+		/* New prefix or new window */
+		if ((memcmp(e->key, key, sizeof(key)) != 0) ||
+		    (e->window_s != window_s)) {
+			(void)memcpy(e->key, key, sizeof(key));
+			e->window_s  = window_s;
+			e->in_bytes  = 0u;
+			e->out_bytes = 0u;
+		}
+
+		in_bytes  = (uint64_t)e->in_bytes + query_len;
+		out_bytes = (uint64_t)e->out_bytes + answer_len;
+
+		if (out_bytes > (in_bytes * self->ratio_max)) {
+			result = true;
+
+			/* Truncated answer is as long as the query */
+			out_bytes = (uint64_t)e->out_bytes + query_len;
+			self->truncated++;
+		}
+
+		e->in_bytes  = (in_bytes  > UINT32_MAX) ? UINT32_MAX :
+			       (uint32_t)in_bytes;
+		e->out_bytes = (out_bytes > UINT32_MAX) ? UINT32_MAX :
+			       (uint32_t)out_bytes;
+	}
+
+	return result;
+}
+
+/** Turns message into empty truncated (TC) answer: header and question
+ *  only. Returns answer length (raw UDP payload length) */
+static size_t dns_msg_truncate(struct dns_msg *self)
+{
+	size_t result = 0u;
+
+	if ((self->malformed == 0u) && (self->_packet_buf != NULL)) {
+		self->_packet_buf[2] = 0x83; /* Response, truncated */
+		self->_packet_buf[3] = 0x80;
+
+		self->_packet_buf[6]  = 0;
+		self->_packet_buf[7]  = 0;
+		self->_packet_buf[8]  = 0;
+		self->_packet_buf[9]  = 0;
+		self->_packet_buf[10] = 0;
+		self->_packet_buf[11] = 0;
+
+		result = self->_ofs;
+	}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS CLIENT ACL
+ *****************************************************************************/
+/** ACL actions */
+#define DNS_ACL_ALLOW      0u /**< Process query */
+#define DNS_ACL_REFUSE     1u /**< Answer with REFUSED */
+#define DNS_ACL_DROP       2u /**< Drop silently */
+#define DNS_ACL_RATE_LIMIT 3u /**< Process within rate limit class */
+
+/** Response codes */
+#define DNS_RCODE_NOERROR  0u
+#define DNS_RCODE_NXDOMAIN 3u
+#define DNS_RCODE_NOTIMP   4u
+#define DNS_RCODE_REFUSED  5u
+
+/** Prefix trie null node index */
+#define DNS_PREFIX_NONE 0xFFFFFFFFu
+
+/** Prefix trie node flag: node holds a prefix (not just a branch point) */
+#define DNS_PREFIX_SET 0x01u
+
+/** Prefix trie node: address prefix, it's value and children. Prefix
+ *  bits of a child extend prefix of it's parent, next bit picks the
+ *  child */
+struct dns_prefix_node {
+	uint8_t flags;      /**< DNS_PREFIX_SET */
+	uint8_t prefix_len; /**< Prefix length in bits */
+	uint8_t bytes[16];  /**< Prefix (bits past prefix are zero) */
+
+	uint32_t value;    /**< User value (DNS_PREFIX_SET only) */
+	uint32_t child[2]; /**< Children by next bit, DNS_PREFIX_NONE if none */
+};
+
+/** Longest prefix match over path compressed binary trie per address
+ *  family, built from caller nodes. Lookup visits at most 33 (IPv4) or
+ *  129 (IPv6) nodes no matter how many prefixes there are, in practice
+ *  about log2 of prefix count. Every prefix takes at most two nodes
+ *  (itself and a branch point) */
+struct dns_prefix_trie {
+	struct dns_prefix_node *_nodes; /**< Nodes (caller storage) */
+	uint32_t _cap; /**< Nodes capacity */
+	uint32_t len;  /**< Number of used nodes */
+
+	uint32_t _root[2]; /**< IPv4 and IPv6 trie roots */
+
+	/** Set to __LINE__ if something is not right */
+	uint32_t malformed;
+};
+
+/** Initializes empty trie */
+static void dns_prefix_trie_init(struct dns_prefix_trie *self,
+				 struct dns_prefix_node *nodes, uint32_t cap)
+{
+	self->_nodes = nodes;
+	self->_cap   = (nodes != NULL) ? cap : 0u;
+	self->len    = 0u;
+
+	self->_root[0] = DNS_PREFIX_NONE;
+	self->_root[1] = DNS_PREFIX_NONE;
+
+	self->malformed = 0u;
+}
+
+/** Returns true if first `prefix_len` bits of `a` and `b` are equal */
+static bool _dns_prefix_eq(const uint8_t *a, const uint8_t *b,
+			   uint8_t prefix_len)
+{
+	uint8_t full = (uint8_t)(prefix_len / 8u);
+	uint8_t rest = (uint8_t)(prefix_len % 8u);
+	uint8_t mask = (uint8_t)(0xFFu << (8u - rest));
+	bool result = (memcmp(a, b, full) == 0);
+
+	if (result && (rest > 0u)) {
+		result = ((a[full] & mask) == (b[full] & mask));
+	}
+
+	return result;
+}
+
+/** Returns bit `bit` of address (0 is the most significant) */
+static uint8_t _dns_prefix_bit(const uint8_t *bytes, uint8_t bit)
+{
+	return (uint8_t)((bytes[bit / 8u] >> (7u - (bit % 8u))) & 1u);
+}
+
+/** Returns number of leading bits (up to `max_len`) `a` and `b` share */
+static uint8_t _dns_prefix_common(const uint8_t *a, const uint8_t *b,
+				  uint8_t max_len)
+{
+	uint8_t result = 0u;
+
+	while ((result < max_len) &&
+	       (_dns_prefix_bit(a, result) == _dns_prefix_bit(b, result))) {
+		result++;
+	}
+
+	return result;
+}
+
+/** Takes trie node for first `prefix_len` bits of `bytes` */
+static uint32_t _dns_prefix_node(struct dns_prefix_trie *self,
+				 const uint8_t *bytes, uint8_t prefix_len)
+{
+	struct dns_prefix_node *e = &self->_nodes[self->len];
+	uint8_t b;
+
+	e->flags      = 0u;
+	e->prefix_len = prefix_len;
+	e->value      = 0u;
+	e->child[0]   = DNS_PREFIX_NONE;
+	e->child[1]   = DNS_PREFIX_NONE;
+
+	/* Zero bits past prefix */
+	(void)memset(e->bytes, 0, sizeof(e->bytes));
+
+	for (b = 0u; b < prefix_len; b++) {
+		e->bytes[b / 8u] |= (uint8_t)(bytes[b / 8u] &
+					      (0x80u >> (b % 8u)));
+	}
+
+	self->len++;
+
+	return self->len - 1u;
+}
+
+/** Adds prefix `addr`/`prefix_len` with value. Adding the same prefix
+ *  again replaces it's value. Returns true on success */
+static bool dns_prefix_trie_add(struct dns_prefix_trie *self,
+				const struct dns_addr *addr,
+				uint8_t prefix_len, uint32_t value)
+{
+	bool result = false;
+	uint8_t max_len = (addr->family == DNS_ADDR_IPV4) ? 32u : 128u;
+	uint32_t *link = &self->_root[(addr->family == DNS_ADDR_IPV4) ? 0 : 1];
+	struct dns_prefix_node *e = NULL;
+	uint32_t n;
+	uint8_t common;
+	uint32_t free_nodes = self->_cap - self->len;
+	bool done = false;
+
+	if ((prefix_len > max_len) || (addr->family == DNS_ADDR_NONE)) {
+		self->malformed = __LINE__;
+		done = true;
+	}
+
+	while (!done) {
+		n = *link;
+
+		if ((n == DNS_PREFIX_NONE) && (free_nodes < 1u)) {
+			self->malformed = __LINE__;
+			done = true;
+		} else if (n == DNS_PREFIX_NONE) {
+			/* Empty slot, prefix becomes leaf */
+			n = _dns_prefix_node(self, addr->bytes, prefix_len);
+			*link = n;
+			e = &self->_nodes[n];
+			done = true;
+		} else {
+			e = &self->_nodes[n];
+			common = _dns_prefix_common(e->bytes, addr->bytes,
+				(e->prefix_len < prefix_len) ?
+				e->prefix_len : prefix_len);
+
+			if ((common == e->prefix_len) &&
+			    (common == prefix_len)) {
+				/* Same prefix, replace in place */
+				done = true;
+			} else if (common == e->prefix_len) {
+				/* Node is prefix of ours, go down */
+				link = &e->child[_dns_prefix_bit(addr->bytes,
+								 common)];
+				e = NULL;
+			} else if (free_nodes < ((common == prefix_len) ?
+						 1u : 2u)) {
+				/* No room, trie is left untouched */
+				self->malformed = __LINE__;
+				e = NULL;
+				done = true;
+			} else if (common == prefix_len) {
+				/* Ours is prefix of node, put it above */
+				*link = _dns_prefix_node(self, addr->bytes,
+							 prefix_len);
+				self->_nodes[*link].child[
+					_dns_prefix_bit(e->bytes, common)] = n;
+				e = &self->_nodes[*link];
+				done = true;
+			} else {
+				/* Paths split, branch node above both */
+				*link = _dns_prefix_node(self, addr->bytes,
+							 common);
+				self->_nodes[*link].child[
+					_dns_prefix_bit(e->bytes, common)] = n;
+
+				n = _dns_prefix_node(self, addr->bytes,
+						     prefix_len);
+				self->_nodes[*link].child[
+					_dns_prefix_bit(addr->bytes,
+							common)] = n;
+				e = &self->_nodes[n];
+				done = true;
+			}
+		}
+	}
+
+	if (e != NULL) {
+		e->flags |= DNS_PREFIX_SET;
+		e->value  = value;
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Returns node of the longest prefix of `addr` added to trie,
+ *  DNS_PREFIX_NONE if none matches */
+static uint32_t dns_prefix_trie_match(const struct dns_prefix_trie *self,
+				      const struct dns_addr *addr)
+{
+	uint32_t result = DNS_PREFIX_NONE;
+	uint32_t n = DNS_PREFIX_NONE;
+	uint8_t max_len = (addr->family == DNS_ADDR_IPV4) ? 32u : 128u;
+	const struct dns_prefix_node *e;
+
+	if (addr->family != DNS_ADDR_NONE) {
+		n = self->_root[(addr->family == DNS_ADDR_IPV4) ? 0 : 1];
+	}
+
+	while (n != DNS_PREFIX_NONE) {
+		e = &self->_nodes[n];
+
+		if (!_dns_prefix_eq(e->bytes, addr->bytes, e->prefix_len)) {
+			n = DNS_PREFIX_NONE; /* Diverged, nothing longer */
+		} else {
+			if ((e->flags & DNS_PREFIX_SET) != 0u) {
+				result = n;
+			}
+
+			n = (e->prefix_len < max_len) ?
+			    e->child[_dns_prefix_bit(addr->bytes,
+						     e->prefix_len)] :
+			    DNS_PREFIX_NONE;
+		}
+	}
+
+	return result;
+}
+
+/** Removes prefix `addr`/`prefix_len`. It's node stays in the trie as a
+ *  branch point, until the trie is rebuilt. Returns true if prefix was
+ *  there */
+static bool dns_prefix_trie_remove(struct dns_prefix_trie *self,
+				   const struct dns_addr *addr,
+				   uint8_t prefix_len)
+{
+	uint32_t found = DNS_PREFIX_NONE;
+	uint32_t n = DNS_PREFIX_NONE;
+	uint8_t max_len = (addr->family == DNS_ADDR_IPV4) ? 32u : 128u;
+	struct dns_prefix_node *e;
+
+	if ((addr->family != DNS_ADDR_NONE) && (prefix_len <= max_len)) {
+		n = self->_root[(addr->family == DNS_ADDR_IPV4) ? 0 : 1];
+	}
+
+	while (n != DNS_PREFIX_NONE) {
+		e = &self->_nodes[n];
+
+		if ((e->prefix_len > prefix_len) ||
+		    !_dns_prefix_eq(e->bytes, addr->bytes, e->prefix_len)) {
+			n = DNS_PREFIX_NONE; /* Not in the trie */
+		} else if (e->prefix_len == prefix_len) {
+			found = ((e->flags & DNS_PREFIX_SET) != 0u) ?
+				n : DNS_PREFIX_NONE;
+			n = DNS_PREFIX_NONE;
+		} else {
+			n = e->child[_dns_prefix_bit(addr->bytes,
+						     e->prefix_len)];
+		}
+	}
+
+	if (found != DNS_PREFIX_NONE) {
+		self->_nodes[found].flags &= (uint8_t)~DNS_PREFIX_SET;
+	}
+
+	return found != DNS_PREFIX_NONE;
+}
+
+/** Client access control list with longest prefix match. Evaluated on
+ *  message context right after receive, before parsing, so denied clients
+ *  cost no parse work. Prefix value holds action (low byte) and rate
+ *  limit class (next byte) */
+struct dns_acl {
+	struct dns_prefix_trie prefixes; /**< Prefixes and their actions */
+
+	uint8_t default_action; /**< Action if nothing matches */
+};
+
+/** Initializes empty ACL over `cap` caller trie nodes */
+static void dns_acl_init(struct dns_acl *self, struct dns_prefix_node *nodes,
+			 uint32_t cap, uint8_t default_action)
+{
+	dns_prefix_trie_init(&self->prefixes, nodes, cap);
+
+	self->default_action = default_action;
+}
+
+/** Adds prefix `addr`/`prefix_len` with action. Adding the same prefix
+ *  again replaces it's action. Returns true on success */
+static bool dns_acl_add(struct dns_acl *self, const struct dns_addr *addr,
+			uint8_t prefix_len, uint8_t action, uint8_t rate_class)
+{
+	return dns_prefix_trie_add(&self->prefixes, addr, prefix_len,
+				   (uint32_t)action |
+				   ((uint32_t)rate_class << 8));
+}
+
+/** Evaluates ACL for address. Returns DNS_ACL_* action of the longest
+ *  matching prefix and stores it's rate limit class into `rate_class`
+ *  (may be NULL) */
+static uint8_t dns_acl_eval(const struct dns_acl *self,
+			    const struct dns_addr *addr, uint8_t *rate_class)
+{
+	uint32_t n = dns_prefix_trie_match(&self->prefixes, addr);
+	uint8_t  result = self->default_action;
+	uint8_t  cls = 0u;
+
+	if (n != DNS_PREFIX_NONE) {
+		result = (uint8_t)(self->prefixes._nodes[n].value & 0xFFu);
+		cls    = (uint8_t)(self->prefixes._nodes[n].value >> 8);
+	}
+
+	if (rate_class != NULL) {
+		*rate_class = cls;
+	}
+
+	return result;
+}
+
+/** Turns parsed query into answer without records, with response code
+ *  `rcode` (DNS_RCODE_*). Returns answer length (raw UDP payload length) */
+static size_t dns_msg_answer_rcode(struct dns_msg *self, uint8_t rcode)
+{
+	size_t result = 0u;
+
+	if ((self->malformed == 0u) && (self->_packet_buf != NULL)) {
+		self->_packet_buf[2] = 0x81;
+		self->_packet_buf[3] = (uint8_t)(0x80u | (rcode & 0x0Fu));
+
+		self->_packet_buf[6]  = 0;
+		self->_packet_buf[7]  = 0;
+		self->_packet_buf[8]  = 0;
+		self->_packet_buf[9]  = 0;
+		self->_packet_buf[10] = 0;
+		self->_packet_buf[11] = 0;
+
+		result = self->_ofs;
+	}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS FEED (INCREMENTAL BLOCKLIST AND RPZ UPDATES)
+ *****************************************************************************/
+/** Suffix tree node flag: name removed (overlay tombstone) */
+#define DNS_SUFFIX_DEL 0x20u
+
+/** Feed layers, newest first: overlay, frozen overlay and base */
+#define DNS_FEED_LAYERS 3u
+
+/** Clears tree, keeping it's storage */
+static void dns_suffix_tree_clear(struct dns_suffix_tree *self)
+{
+	dns_suffix_tree_init(self, self->_nodes, self->_cap, self->_labels,
+			     self->_labels_cap);
+}
+
+/** Feed of names updated by deltas, used for suffix block lists
+ *  (`dns_feed_match`) and RPZ triggers (`struct dns_rpz`).
+ *  Large compact base tree is never modified. Deltas (from IXFR or a
+ *  line based diff) go into a small overlay tree, updated in place:
+ *  additions as names, removals as tombstones. Lookups consult every
+ *  layer in one walk, the newest layer having the name decides, so a feed
+ *  update costs work proportional to the delta, not to the feed.
+ *
+ *  Compaction builds a new base instead of touching the old one:
+ *  `dns_feed_compact_begin` freezes the overlay and starts an empty one
+ *  for further deltas, `dns_feed_compact` merges base and frozen overlay
+ *  into a fresh tree and `dns_feed_swap` switches to it. No delta is lost.
+ *
+ *  A feed has a single writer: lookups, deltas, `dns_feed_compact_begin`
+ *  and `dns_feed_swap` must not run concurrently (one thread, or caller's
+ *  lock). Only `dns_feed_compact` may run on another thread meanwhile, as
+ *  it only reads base and frozen overlay, which nobody modifies */
+struct dns_feed {
+	const struct dns_suffix_tree *base; /**< Compact base (read only) */
+	struct dns_suffix_tree *overlay;    /**< Deltas (NULL: read only) */
+
+	/** Overlay being compacted (read only), NULL if not compacting */
+	const struct dns_suffix_tree *_frozen;
+
+	uint32_t added;   /**< Names added into current overlay */
+	uint32_t removed; /**< Names removed in current overlay */
+
+	/** Set to __LINE__ if something is not right */
+	uint32_t malformed;
+};
+
+/** Initializes feed over base tree (may be empty) and overlay tree. With
+ *  NULL overlay feed is read only (a plain compiled tree) */
+static void dns_feed_init(struct dns_feed *self,
+			  const struct dns_suffix_tree *base,
+			  struct dns_suffix_tree *overlay)
+{
+	self->base    = base;
+	self->overlay = overlay;
+	self->_frozen = NULL;
+
+	self->added   = 0u;
+	self->removed = 0u;
+
+	self->malformed = 0u;
+}
+
+/** Returns feed layer (0 is the newest), NULL if layer is missing */
+static const struct dns_suffix_tree *_dns_feed_layer(
+	const struct dns_feed *self, uint32_t layer)
+{
+	const struct dns_suffix_tree *result = self->base;
+
+	if (layer == 0u) {
+		result = self->overlay;
+	} else if (layer == 1u) {
+		result = self->_frozen;
+	} else {}
+
+	return result;
+}
+
+/** Starts layered walk: `node` of every layer is set to the root,
+ *  missing layers get DNS_INDEX_NONE */
+static void _dns_feed_walk_init(const struct dns_feed *self, uint32_t *node)
+{
+	uint32_t i;
+
+	for (i = 0u; i < DNS_FEED_LAYERS; i++) {
+		node[i] = (_dns_feed_layer(self, i) != NULL) ?
+			  DNS_SUFFIX_ROOT : DNS_INDEX_NONE;
+	}
+}
+
+/** Moves `node` of every layer to it's child with `label`. Returns true
+ *  while any layer still has the name */
+static bool _dns_feed_walk_child(const struct dns_feed *self, uint32_t *node,
+				 const uint8_t *label)
+{
+	bool result = false;
+	uint32_t i;
+
+	for (i = 0u; i < DNS_FEED_LAYERS; i++) {
+		if (node[i] != DNS_INDEX_NONE) {
+			node[i] = dns_suffix_tree_child(
+				_dns_feed_layer(self, i), node[i], label);
+		}
+
+		result = result || (node[i] != DNS_INDEX_NONE);
+	}
+
+	return result;
+}
+
+/** Returns node of the newest layer where name of the walk was inserted
+ *  (listed or removed), NULL if no layer has it */
+static const struct dns_suffix_node *_dns_feed_walk_term(
+	const struct dns_feed *self, const uint32_t *node)
+{
+	const struct dns_suffix_node *result = NULL;
+	const struct dns_suffix_node *n;
+	uint32_t i;
+
+	for (i = 0u; (i < DNS_FEED_LAYERS) && (result == NULL); i++) {
+		if ((node[i] != DNS_INDEX_NONE) &&
+		    (node[i] != DNS_SUFFIX_ROOT)) {
+			n = &_dns_feed_layer(self, i)->_nodes[node[i]];
+
+			if ((n->flags & DNS_SUFFIX_TERM) != 0u) {
+				result = n;
+			}
+		}
+	}
+
+	return result;
+}
+
+/** Inserts name into overlay as addition or tombstone */
+static bool _dns_feed_put(struct dns_feed *self, const uint8_t *name,
+			  size_t name_len, uint32_t value, bool removed)
+{
+	uint32_t node = DNS_INDEX_NONE;
+
+	if (self->overlay != NULL) {
+		node = dns_suffix_tree_insert(self->overlay, name, name_len,
+					      value);
+	}
+
+	if (node == DNS_INDEX_NONE) {
+		self->malformed = __LINE__;
+	} else if (removed) {
+		self->overlay->_nodes[node].flags |= DNS_SUFFIX_DEL;
+		self->removed++;
+	} else {
+		self->overlay->_nodes[node].flags &= (uint8_t)~DNS_SUFFIX_DEL;
+		self->added++;
+	}
+
+	return node != DNS_INDEX_NONE;
+}
+
+/** Adds name (wire format) with value. Returns true on success */
+static bool dns_feed_add(struct dns_feed *self, const uint8_t *name,
+			 size_t name_len, uint32_t value)
+{
+	return _dns_feed_put(self, name, name_len, value, false);
+}
+
+/** Removes name (wire format). Returns true on success */
+static bool dns_feed_remove(struct dns_feed *self, const uint8_t *name,
+			    size_t name_len)
+{
+	return _dns_feed_put(self, name, name_len, 0u, true);
+}
+
+/** Applies one line of a diff file: "+name" adds name with `value`,
+ *  "-name" removes it. Empty lines and "#" comments are skipped, blanks
+ *  after the marker and trailing whitespace are ignored, a blank within
+ *  the name is invalid. Returns false if line is invalid */
+static bool dns_feed_apply_line(struct dns_feed *self, const char *line,
+				size_t len, uint32_t value)
+{
+	char    str[DNS_NAME_WIRE_MAX + 1u];
+	uint8_t wire[DNS_NAME_WIRE_MAX];
+	size_t  wire_len = 0u;
+	size_t  begin = 1u; /* Name start, after the marker */
+	size_t  end = len;
+	size_t  i;
+	bool    result = true;
+
+	while ((end > 0u) && ((line[end - 1u] == ' ') ||
+	       (line[end - 1u] == '\t') || (line[end - 1u] == '\r') ||
+	       (line[end - 1u] == '\n'))) {
+		end--;
+	}
+
+	while ((begin < end) &&
+	       ((line[begin] == ' ') || (line[begin] == '\t'))) {
+		begin++;
+	}
+
+	for (i = begin; i < end; i++) {
+		if ((line[i] == ' ') || (line[i] == '\t')) {
+			result = false;
+		}
+	}
+
+	if ((end == 0u) || (line[0] == '#')) {
+		result = true; /* Nothing to apply */
+	} else if (!result || ((line[0] != '+') && (line[0] != '-')) ||
+		   ((end - begin) > DNS_NAME_WIRE_MAX)) {
+		result = false;
+	} else {
+		(void)memcpy(str, &line[begin], end - begin);
+		str[end - begin] = '\0';
+
+		wire_len = dns_name_from_str(str, wire, sizeof(wire));
+
+		if (wire_len <= 1u) {
+			result = false;
+		} else if (line[0] == '+') {
+			result = dns_feed_add(self, wire, wire_len, value);
+		} else {
+			result = dns_feed_remove(self, wire, wire_len);
+		}
+	}
+
+	if (!result) {
+		self->malformed = __LINE__;
+	}
+
+	return result;
+}
+
+/** Finds the deepest listed suffix of wire name (the name itself or any of
+ *  it's parents), walking all layers together. At every depth the newest
+ *  layer having the name decides. Stores it's value into `value` (may be
+ *  NULL). Returns true if name is listed */
+static bool dns_feed_match(const struct dns_feed *self, const uint8_t *name,
+			   size_t name_len, uint32_t *value)
+{
+	uint8_t  ofs[DNS_NAME_LABELS_MAX];
+	size_t   n = _dns_name_labels(name, name_len, ofs);
+	uint32_t node[DNS_FEED_LAYERS];
+	bool     result = false;
+	bool     more = true;
+	const struct dns_suffix_node *t;
+
+	n = (n > 0u) ? (n - 1u) : 0u;
+
+	_dns_feed_walk_init(self, node);
+
+	while (more && (n > 0u)) {
+		more = _dns_feed_walk_child(self, node, &name[ofs[n - 1u]]);
+		t = _dns_feed_walk_term(self, node);
+
+		/* Added or removed at this depth */
+		if ((t != NULL) && ((t->flags & DNS_SUFFIX_DEL) == 0u)) {
+			result = true;
+
+			if (value != NULL) {
+				*value = t->value;
+			}
+		}
+
+		n--;
+	}
+
+	return result;
+}
+
+/** Starts compaction: current overlay is frozen, `overlay` is cleared
+ *  and takes further deltas. Returns false if feed is already compacting
+ *  or read only */
+static bool dns_feed_compact_begin(struct dns_feed *self,
+				   struct dns_suffix_tree *overlay)
+{
+	bool result = (self->_frozen == NULL) && (self->overlay != NULL) &&
+		      (overlay != NULL) && (overlay != self->overlay);
+
+	if (result) {
+		dns_suffix_tree_clear(overlay);
+
+		self->_frozen = self->overlay;
+		self->overlay = overlay;
+
+		self->added   = 0u;
+		self->removed = 0u;
+	} else {
+		self->malformed = __LINE__;
+	}
+
+	return result;
+}
+
+/** Merges base and frozen overlay into empty tree `dst`. Only reads base
+ *  and frozen overlay, so may run on another thread while the feed takes
+ *  lookups and deltas. Returns true on success, then call `dns_feed_swap`
+ *  (feed writer thread) */
+static bool dns_feed_compact(const struct dns_feed *self,
+			     struct dns_suffix_tree *dst)
+{
+	const struct dns_suffix_tree *frozen = self->_frozen;
+	uint8_t  name[DNS_NAME_WIRE_MAX];
+	size_t   len;
+	uint32_t node;
+	uint32_t o;
+	const struct dns_suffix_node *n;
+
+	if (frozen == NULL) {
+		dst->malformed = __LINE__;
+	}
+
+	/* Base names, unless frozen overlay replaced or removed them */
+	node = (dst->malformed == 0u) ?
+	       dns_suffix_tree_next(self->base, DNS_SUFFIX_ROOT,
+				    DNS_SUFFIX_ROOT) : DNS_INDEX_NONE;
+
+	while ((node != DNS_INDEX_NONE) && (dst->malformed == 0u)) {
+		n = &self->base->_nodes[node];
+
+		if ((n->flags & DNS_SUFFIX_TERM) != 0u) {
+			len = dns_suffix_tree_name(self->base, node, name,
+						   sizeof(name));
+			o   = dns_suffix_tree_find(frozen, name, len);
+
+			if (o == DNS_INDEX_NONE) {
+				(void)dns_suffix_tree_insert(dst, name, len,
+							     n->value);
+			}
+		}
+
+		node = dns_suffix_tree_next(self->base, DNS_SUFFIX_ROOT, node);
+	}
+
+	/* Frozen overlay additions */
+	node = (dst->malformed == 0u) ?
+	       dns_suffix_tree_next(frozen, DNS_SUFFIX_ROOT,
+				    DNS_SUFFIX_ROOT) : DNS_INDEX_NONE;
+
+	while ((node != DNS_INDEX_NONE) && (dst->malformed == 0u)) {
+		n = &frozen->_nodes[node];
+
+		if ((n->flags & (DNS_SUFFIX_TERM | DNS_SUFFIX_DEL)) ==
+		    DNS_SUFFIX_TERM) {
+			len = dns_suffix_tree_name(frozen, node, name,
+						   sizeof(name));
+			(void)dns_suffix_tree_insert(dst, name, len, n->value);
+		}
+
+		node = dns_suffix_tree_next(frozen, DNS_SUFFIX_ROOT, node);
+	}
+
+	return dst->malformed == 0u;
+}
+
+/** Ends compaction: switches feed to compacted `base` and drops frozen
+ *  overlay. Deltas applied during compaction stay in the overlay. Old
+ *  base and frozen overlay storage is free for reuse afterwards */
+static void dns_feed_swap(struct dns_feed *self,
+			  const struct dns_suffix_tree *base)
+{
+	self->base    = base;
+	self->_frozen = NULL;
+}
+
+/*****************************************************************************
+ * DNS RESPONSE POLICY ZONES (RPZ)
+ *****************************************************************************/
+/** RPZ actions */
+#define DNS_RPZ_NONE       0u /**< No trigger matched */
+#define DNS_RPZ_PASSTHRU   1u /**< Answer normally, skip other triggers */
+#define DNS_RPZ_NXDOMAIN   2u /**< Answer NXDOMAIN */
+#define DNS_RPZ_NODATA     3u /**< Answer NOERROR without records */
+#define DNS_RPZ_LOCAL_DATA 4u /**< Answer with policy record */
+#define DNS_RPZ_DROP       5u /**< Drop query silently */
+
+/** Packs RPZ action and local data id into name trigger value */
+#define DNS_RPZ_VALUE(action, data) \
+	((uint32_t)(action) | ((uint32_t)(data) << 8))
+
+/** Response policy zones. Triggers are compiled into matchers whose
+ *  lookup cost is bounded by the name or address being checked, not by
+ *  feed size:
+ *  - QNAME and NSDNAME triggers: feeds (`struct dns_feed`), one hash probe
+ *    per label and feed layer. Exact names match themselves, "*.name"
+ *    matches everything below name. Deltas go through `dns_feed_add`
+ *    (value from DNS_RPZ_VALUE) and `dns_feed_remove`, wildcards
+ *    included; a feed with NULL overlay is a plain compiled tree;
+ *  - CLIENT-IP and response IP triggers: prefix trie, at most one node
+ *    per address bit (longest prefix wins). Tries are small and take
+ *    deltas in place (`dns_rpz_add_ip`, `dns_prefix_trie_remove`).
+ *  Every trigger value is DNS_RPZ_VALUE of it's action and local data id.
+ *  Any of the matchers may be NULL. Local data is referenced by id, the
+ *  caller maps it to precompiled records (`dns_rr_build`) */
+struct dns_rpz {
+	const struct dns_feed *qname;   /**< QNAME triggers */
+	const struct dns_feed *nsdname; /**< NSDNAME triggers */
+	const struct dns_prefix_trie *client_ip;   /**< CLIENT-IP triggers */
+	const struct dns_prefix_trie *response_ip; /**< Response IP triggers */
+
+	uint32_t hits; /**< Number of triggered policies (PASSTHRU too) */
+};
+
+/** Initializes policy engine over compiled matchers */
+static void dns_rpz_init(struct dns_rpz *self,
+			 const struct dns_feed *qname,
+			 const struct dns_feed *nsdname,
+			 const struct dns_prefix_trie *client_ip,
+			 const struct dns_prefix_trie *response_ip)
+{
+	self->qname       = qname;
+	self->nsdname     = nsdname;
+	self->client_ip   = client_ip;
+	self->response_ip = response_ip;
+
+	self->hits = 0u;
+}
+
+/** Adds name trigger ("example.com" or "*.example.com") into QNAME or
+ *  NSDNAME base tree. Returns node index (DNS_INDEX_NONE on failure) */
+static uint32_t dns_rpz_add_name(struct dns_suffix_tree *tree,
+				 const uint8_t *name, size_t name_len,
+				 uint8_t action, uint32_t data)
+{
+	return dns_suffix_tree_insert(tree, name, name_len,
+				      DNS_RPZ_VALUE(action, data));
+}
+
+/** Adds CLIENT-IP or response IP trigger `addr`/`prefix_len` into `trie`.
+ *  Returns true on success */
+static bool dns_rpz_add_ip(struct dns_prefix_trie *trie,
+			   const struct dns_addr *addr, uint8_t prefix_len,
+			   uint8_t action, uint32_t data)
+{
+	return dns_prefix_trie_add(trie, addr, prefix_len,
+				   DNS_RPZ_VALUE(action, data));
+}
+
+/** Matches address against IP trigger trie. Returns trigger value,
+ *  DNS_RPZ_NONE if nothing matched */
+static uint32_t _dns_rpz_match_ip(const struct dns_prefix_trie *trie,
+				  const struct dns_addr *addr)
+{
+	uint32_t n = DNS_PREFIX_NONE;
+
+	if (trie != NULL) {
+		n = dns_prefix_trie_match(trie, addr);
+	}
+
+	return (n != DNS_PREFIX_NONE) ? trie->_nodes[n].value : DNS_RPZ_NONE;
+}
+
+/** Returns value of the newest wildcard ("*") child of walk nodes, or
+ *  `wild` if no layer has one there (or the newest one was removed) */
+static uint32_t _dns_rpz_wild(const struct dns_feed *feed,
+			      const uint32_t *node, uint32_t wild)
+{
+	const struct dns_suffix_tree *tree;
+	const struct dns_suffix_node *t;
+	uint32_t w[DNS_FEED_LAYERS];
+	uint32_t result = wild;
+	uint32_t i;
+
+	for (i = 0u; i < DNS_FEED_LAYERS; i++) {
+		tree = _dns_feed_layer(feed, i);
+		w[i] = DNS_INDEX_NONE;
+
+		if ((node[i] != DNS_INDEX_NONE) &&
+		    (node[i] != DNS_SUFFIX_ROOT) &&
+		    ((tree->_nodes[node[i]].flags & DNS_SUFFIX_WILD) != 0u)) {
+			w[i] = dns_suffix_tree_child(tree, node[i],
+						     _dns_wildcard_label);
+		}
+	}
+
+	t = _dns_feed_walk_term(feed, w);
+
+	if ((t != NULL) && ((t->flags & DNS_SUFFIX_DEL) == 0u)) {
+		result = t->value;
+	}
+
+	return result;
+}
+
+/** Matches name against trigger feed in one walk over all it's layers.
+ *  Exact trigger wins over wildcard, deeper wildcard wins over shallower,
+ *  newer layer wins over older. Returns trigger value, DNS_RPZ_NONE if
+ *  nothing matched */
+static uint32_t _dns_rpz_match(const struct dns_feed *feed,
+			       const uint8_t *name, size_t name_len)
+{
+	uint8_t  ofs[DNS_NAME_LABELS_MAX];
+	size_t   n = _dns_name_labels(name, name_len, ofs);
+	uint32_t node[DNS_FEED_LAYERS];
+	uint32_t wild = DNS_RPZ_NONE;
+	uint32_t result;
+	bool     more = (feed != NULL);
+	const struct dns_suffix_node *t = NULL;
+
+	n = (n > 0u) ? (n - 1u) : 0u;
+
+	if (more) {
+		_dns_feed_walk_init(feed, node);
+	}
+
+	while (more && (n > 0u)) {
+		/* Wildcard of this node covers the rest of the name */
+		wild = _dns_rpz_wild(feed, node, wild);
+		more = _dns_feed_walk_child(feed, node, &name[ofs[n - 1u]]);
+		n--;
+	}
+
+	if (more && (n == 0u)) {
+		t = _dns_feed_walk_term(feed, node);
+	}
+
+	if ((t != NULL) && ((t->flags & DNS_SUFFIX_DEL) == 0u)) {
+		result = t->value;
+	} else {
+		result = wild; /* No exact trigger, or it was removed */
+	}
+
+	return result;
+}
+
+/** Evaluates policy of a single trigger value. Returns DNS_RPZ_* */
+static uint8_t _dns_rpz_result(struct dns_rpz *self, uint32_t value,
+			       uint32_t *data)
+{
+	uint8_t action = (uint8_t)(value & 0xFFu);
+
+	if (action != DNS_RPZ_NONE) {
+		self->hits++;
+
+		if (data != NULL) {
+			*data = value >> 8;
+		}
+	}
+
+	return action;
+}
+
+/** Evaluates query triggers (CLIENT-IP, then QNAME) for parsed query.
+ *  Returns DNS_RPZ_* and stores local data id into `data` (may be NULL) */
+static uint8_t dns_rpz_eval_query(struct dns_rpz *self,
+				  const struct dns_msg_ctx *ctx,
+				  struct dns_msg *msg, uint32_t *data)
+{
+	uint8_t action = DNS_RPZ_NONE;
+
+	if (data != NULL) {
+		*data = 0u;
+	}
+
+	if (ctx->client.family != DNS_ADDR_NONE) {
+		action = _dns_rpz_result(self,
+			_dns_rpz_match_ip(self->client_ip, &ctx->client), data);
+	}
+
+	if ((action == DNS_RPZ_NONE) && (msg->malformed == 0u)) {
+		action = _dns_rpz_result(self,
+			_dns_rpz_match(self->qname, &msg->_packet_buf[12],
+				       msg->_qname_len), data);
+	}
+
+	return action;
+}
+
+/** Evaluates response IP trigger for an address about to be answered.
+ *  Returns DNS_RPZ_* and stores local data id into `data` (may be NULL) */
+static uint8_t dns_rpz_eval_response_ip(struct dns_rpz *self,
+					const struct dns_addr *addr,
+					uint32_t *data)
+{
+	return _dns_rpz_result(self, _dns_rpz_match_ip(self->response_ip,
+							addr), data);
+}
+
+/** Evaluates NSDNAME trigger for a name server name (wire format) met
+ *  while resolving. Returns DNS_RPZ_* and stores local data id into
+ *  `data` (may be NULL) */
+static uint8_t dns_rpz_eval_nsdname(struct dns_rpz *self,
+				    const uint8_t *name, size_t name_len,
+				    uint32_t *data)
+{
+	return _dns_rpz_result(self, _dns_rpz_match(self->nsdname, name,
+						     name_len), data);
+}
+
+/** Applies policy action to parsed query. `rr` is precompiled local data
+ *  record (DNS_RPZ_LOCAL_DATA only). Returns answer length (raw UDP
+ *  payload length), or 0 if query should be dropped (DNS_RPZ_DROP) or
+ *  answered normally (DNS_RPZ_NONE, DNS_RPZ_PASSTHRU) */
+static size_t dns_rpz_apply(struct dns_msg *msg, uint8_t action,
+			    uint8_t *rr, size_t rr_len)
+{
+	size_t result = 0u;
+
+	if (action == DNS_RPZ_NXDOMAIN) {
+		result = dns_msg_answer_rcode(msg, DNS_RCODE_NXDOMAIN);
+	} else if (action == DNS_RPZ_NODATA) {
+		result = dns_msg_answer_rcode(msg, DNS_RCODE_NOERROR);
+	} else if ((action == DNS_RPZ_LOCAL_DATA) && (rr != NULL)) {
+		result = dns_msg_add_answer(msg, rr, rr_len);
+	} else {}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS BLOCKLIST COMPILER
+ *****************************************************************************/
+/** Suffix tree image magic ("DNST"), also detects byte order mismatch */
+#define DNS_IMAGE_MAGIC 0x444E5354u
+
+/** Suffix tree image version */
+#define DNS_IMAGE_VERSION 1u
+
+/** Suffix tree image header length */
+#define DNS_IMAGE_HDR_LEN 24u
+
+/** Returns true if char is part of a host name */
+static bool _dns_list_is_name_char(char c)
+{
+	return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+	       ((c >= '0') && (c <= '9')) || (c == '-') || (c == '.') ||
+	       (c == '_');
+}
+
+/** Returns true if `len` chars at `s` are a host name worth blocking: at
+ *  least two labels and not an address (all numeric TLD, "1.2.3.4") */
+static bool _dns_list_is_host(const char *s, size_t len)
+{
+	size_t n = len;
+	size_t last = 0u; /* Start of the last label */
+	size_t i;
+	bool   digits = true;
+
+	/* Trailing dot of absolute name is not a dot between labels */
+	if ((n > 0u) && (s[n - 1u] == '.')) {
+		n--;
+	}
+
+	for (i = 0u; i < n; i++) {
+		if (s[i] == '.') {
+			last = i + 1u;
+		}
+	}
+
+	for (i = last; i < n; i++) {
+		digits = digits && (s[i] >= '0') && (s[i] <= '9');
+	}
+
+	return (last > 0u) && (last < n) && !digits;
+}
+
+/** Parses next name of a block list line into wire name. Start every line
+ *  with `*pos` = 0 and call again while names come out, `*pos` is moved
+ *  past each name. Understands:
+ *  - hosts files: "0.0.0.0 ads.example.com ads2.example.com" (every host
+ *    name after the address, one per call);
+ *  - domain lists: "ads.example.com";
+ *  - adblock rules: "||ads.example.com^" (rules with options, exceptions
+ *    and anything else adblock can express are skipped).
+ *  Comments ("#", "!", "["), empty lines, bare addresses and names
+ *  without a dot ("localhost", "broadcasthost") yield nothing.
+ *  Returns wire name length, 0 if line has no more names to block */
+static size_t dns_list_parse_line(const char *line, size_t len, size_t *pos,
+				  uint8_t *wire, size_t cap)
+{
+	char   str[DNS_NAME_WIRE_MAX + 1u];
+	size_t result = 0u;
+	size_t i = *pos;
+	size_t start;
+	size_t end;
+	bool   adblock = false;
+	bool   more = true;
+	bool   ok;
+
+	/* Line start: comment, adblock rule or hosts address column */
+	while ((*pos == 0u) && (i < len) &&
+	       ((line[i] == ' ') || (line[i] == '\t'))) {
+		i++;
+	}
+
+	if (*pos != 0u) {
+		/* Names after the first one */
+	} else if ((i < len) && ((line[i] == '#') || (line[i] == '!') ||
+				 (line[i] == '['))) {
+		more = false; /* Comment */
+	} else if (((i + 2u) <= len) && (line[i] == '|') &&
+		   (line[i + 1u] == '|')) {
+		adblock = true;
+		i += 2u;
+	} else {
+		/* hosts: skip address column (IPv4 digits and dots, or IPv6
+		 * with colons) followed by blank */
+		bool ipv4 = true;
+		bool ipv6 = false;
+
+		start = i;
+
+		while ((start < len) && (line[start] != ' ') &&
+		       (line[start] != '\t') && (line[start] != '#')) {
+			ipv4 = ipv4 && (((line[start] >= '0') &&
+					 (line[start] <= '9')) ||
+					(line[start] == '.'));
+			ipv6 = ipv6 || (line[start] == ':');
+			start++;
+		}
+
+		if ((ipv4 || ipv6) && (start < len) && (line[start] != '#')) {
+			i = start;
+		}
+	}
+
+	while (more && (i < len)) {
+		while ((i < len) && ((line[i] == ' ') || (line[i] == '\t'))) {
+			i++;
+		}
+
+		start = i;
+
+		while ((i < len) && _dns_list_is_name_char(line[i])) {
+			i++;
+		}
+
+		end = i;
+
+		if (adblock) {
+			/* Must be "||name^" and nothing else */
+			ok = (i < len) && (line[i] == '^') &&
+			     (((i + 1u) == len) || (line[i + 1u] == '\r') ||
+			      (line[i + 1u] == '\n'));
+			i = len;
+		} else {
+			/* Name must be followed by blank, comment or end */
+			ok = (i == len) || (line[i] == ' ') ||
+			     (line[i] == '\t') || (line[i] == '#') ||
+			     (line[i] == '\r') || (line[i] == '\n');
+		}
+
+		if (ok && ((end - start) <= DNS_NAME_WIRE_MAX) &&
+		    _dns_list_is_host(&line[start], end - start)) {
+			(void)memcpy(str, &line[start], end - start);
+			str[end - start] = '\0';
+
+			result = dns_name_from_str(str, wire, cap);
+		}
+
+		/* Skip the rest of a token that is not a name */
+		while ((i < len) && (line[i] != ' ') && (line[i] != '\t') &&
+		       (line[i] != '#')) {
+			i++;
+		}
+
+		more = (result == 0u) && (i < len) && (line[i] != '#');
+	}
+
+	*pos = (i > *pos) ? i : len;
+
+	return result;
+}
+
+/** Returns size of suffix tree image (header, nodes, labels) */
+static size_t dns_suffix_tree_image_size(const struct dns_suffix_tree *self)
+{
+	return DNS_IMAGE_HDR_LEN +
+	       ((size_t)self->_cap * sizeof(struct dns_suffix_node)) +
+	       (size_t)self->labels_len;
+}
+
+/** Stores 32 bit value (native byte order) */
+static void _dns_store32(uint8_t *p, uint32_t value)
+{
+	(void)memcpy(p, &value, sizeof(value));
+}
+
+/** Saves compiled tree into binary image, which can be mapped back
+ *  (mmap) and used by the query path without parsing or copying.
+ *  Image is in native byte order. Returns image length, 0 if it doesn't
+ *  fit into `cap` */
+static size_t dns_suffix_tree_save(const struct dns_suffix_tree *self,
+				   uint8_t *buf, size_t cap)
+{
+	size_t result = dns_suffix_tree_image_size(self);
+	size_t nodes_len = (size_t)self->_cap * sizeof(struct dns_suffix_node);
+
+	if ((self->malformed != 0u) || (result > cap)) {
+		result = 0u;
+	} else {
+		_dns_store32(&buf[0],  DNS_IMAGE_MAGIC);
+		_dns_store32(&buf[4],  (DNS_IMAGE_VERSION << 16) |
+				       (uint32_t)sizeof(struct dns_suffix_node));
+		_dns_store32(&buf[8],  self->_cap);
+		_dns_store32(&buf[12], self->len);
+		_dns_store32(&buf[16], self->labels_len);
+		_dns_store32(&buf[20], self->_root_child);
+
+		(void)memcpy(&buf[DNS_IMAGE_HDR_LEN], self->_nodes, nodes_len);
+		(void)memcpy(&buf[DNS_IMAGE_HDR_LEN + nodes_len],
+			     self->_labels, self->labels_len);
+	}
+
+	return result;
+}
+
+/** Returns true if node index is none or a used node */
+static bool _dns_suffix_link_ok(const struct dns_suffix_tree *self,
+				uint32_t node)
+{
+	return (node == DNS_INDEX_NONE) ||
+	       ((node < self->_cap) &&
+		((self->_nodes[node].flags & DNS_SUFFIX_USED) != 0u));
+}
+
+/** Checks every node of a tree read from outside in one pass over nodes:
+ *  labels within the pool, links within the node array, depth growing
+ *  by one from parent (so parent chains end at root), and sibling lists
+ *  reaching every used node exactly once (no loops). Returns true if the
+ *  tree is safe to walk */
+static bool _dns_suffix_tree_valid(const struct dns_suffix_tree *self)
+{
+	const struct dns_suffix_node *node;
+	uint32_t used = 0u;
+	uint32_t steps = 0u;
+	uint32_t owner;
+	uint32_t n;
+	uint32_t i;
+	bool     ok = _dns_suffix_link_ok(self, self->_root_child);
+
+	for (i = 0u; ok && (i < self->_cap); i++) {
+		node = &self->_nodes[i];
+
+		if ((node->flags & DNS_SUFFIX_USED) != 0u) {
+			used++;
+
+			ok = (node->label_len > 0u) && (node->label_len <= 63u) &&
+			     (node->label_ofs <= self->labels_len) &&
+			     (node->label_len <=
+			      (self->labels_len - node->label_ofs)) &&
+			     _dns_suffix_link_ok(self, node->child) &&
+			     _dns_suffix_link_ok(self, node->next);
+
+			if (!ok) {
+				/* Bad label or link */
+			} else if (node->parent == DNS_SUFFIX_ROOT) {
+				ok = (node->depth == 1u);
+			} else {
+				ok = (node->parent < self->_cap) &&
+				     _dns_suffix_link_ok(self, node->parent) &&
+				     (node->depth ==
+				      (self->_nodes[node->parent].depth + 1u));
+			}
+		}
+	}
+
+	/* Walk sibling list of root and of every node: all lists together
+	 * visit each used node once, a loop would go past the count */
+	for (i = 0u; ok && (i <= self->_cap); i++) {
+		owner = (i < self->_cap) ? i : DNS_SUFFIX_ROOT;
+		n = DNS_INDEX_NONE;
+
+		if (owner == DNS_SUFFIX_ROOT) {
+			n = self->_root_child;
+		} else if ((self->_nodes[owner].flags &
+			    DNS_SUFFIX_USED) != 0u) {
+			n = self->_nodes[owner].child;
+		} else {}
+
+		while (ok && (n != DNS_INDEX_NONE)) {
+			ok = (steps < used) &&
+			     (self->_nodes[n].parent == owner);
+			steps++;
+			n = self->_nodes[n].next;
+		}
+	}
+
+	return ok && (used == self->len) && (steps == used);
+}
+
+/** Maps tree onto binary image in place (no copy). `buf` must be 4 byte
+ *  aligned (mmap is) and stay valid while tree is used. If image is mapped
+ *  read only, the tree must only be looked up. Every node is checked once
+ *  (O(n)), so a damaged or forged image can't send lookups or walks out
+ *  of bounds or into loops. Returns true if image is valid */
+static bool dns_suffix_tree_load(struct dns_suffix_tree *self, uint8_t *buf,
+				 size_t len)
+{
+	bool result = false;
+	uint32_t magic;
+	uint32_t version;
+	size_t   nodes_len;
+
+	self->malformed = __LINE__;
+
+	if ((buf != NULL) && (len >= DNS_IMAGE_HDR_LEN) &&
+	    (((uintptr_t)buf & 3u) == 0u)) {
+		magic   = _dns_load32(&buf[0]);
+		version = _dns_load32(&buf[4]);
+
+		self->_cap        = _dns_load32(&buf[8]);
+		self->len         = _dns_load32(&buf[12]);
+		self->labels_len  = _dns_load32(&buf[16]);
+		self->_labels_cap = self->labels_len;
+		self->_root_child = _dns_load32(&buf[20]);
+
+		nodes_len = (size_t)self->_cap * sizeof(struct dns_suffix_node);
+
+		if ((magic == DNS_IMAGE_MAGIC) &&
+		    (version == ((DNS_IMAGE_VERSION << 16) |
+				 (uint32_t)sizeof(struct dns_suffix_node))) &&
+		    (self->_cap > 0u) &&
+		    ((self->_cap & (self->_cap - 1u)) == 0u) &&
+		    (self->_cap <= ((len - DNS_IMAGE_HDR_LEN) /
+				    sizeof(struct dns_suffix_node))) &&
+		    (len == (DNS_IMAGE_HDR_LEN + nodes_len +
+			     (size_t)self->labels_len))) {
+			self->_nodes  = (struct dns_suffix_node *)(void *)
+					&buf[DNS_IMAGE_HDR_LEN];
+			self->_labels = &buf[DNS_IMAGE_HDR_LEN + nodes_len];
+
+			result = _dns_suffix_tree_valid(self);
+		}
+
+		if (result) {
+			self->malformed = 0u;
+		}
+	}
+
+	if (!result) {
+		self->_cap = 0u;
+		self->len  = 0u;
+	}
+
+	return result;
+}
+
+/*****************************************************************************
+ * DNS CAPTIVE PORTAL RESPONDER
+ *****************************************************************************/
+/** Wildcard responder for captive portals: every class IN A/AAAA query is
+ *  answered with configured address, any other type gets NODATA (NOERROR
+ *  without records) and any other class is REFUSED. Responses (QR set) are
+ *  dropped, so two responders can't loop, and any opcode but QUERY gets
+ *  NOTIMP. Answer RRs are
+ *  precompiled once with compression pointer to QNAME, so answering is a
+ *  memcpy onto the parse buffer, without any per query encoding */
+struct dns_captive {
+	uint8_t _a_rr[12u + 4u];     /**< Precompiled A answer */
+	uint8_t _aaaa_rr[12u + 16u]; /**< Precompiled AAAA answer */
+
+	uint8_t _a_rr_len;    /**< A answer length, 0 if no IPv4 address */
+	uint8_t _aaaa_rr_len; /**< AAAA answer length, 0 if no IPv6 address */
+
+	uint32_t answered; /**< Number of address answers */
+	uint32_t nodata;   /**< Number of NODATA answers */
+	uint32_t refused;  /**< Number of REFUSED (not class IN) answers */
+	uint32_t notimp;   /**< Number of NOTIMP (not QUERY) answers */
+	uint32_t dropped;  /**< Number of dropped responses (QR set) */
+};
+
+/** Initializes captive responder. `ipv4` (4 bytes) and `ipv6` (16 bytes)
+ *  are portal addresses, either may be NULL (NODATA is answered then) */
+static void dns_captive_init(struct dns_captive *self, const uint8_t *ipv4,
+			     const uint8_t *ipv6, uint32_t ttl_s)
+{
+	self->_a_rr_len    = 0u;
+	self->_aaaa_rr_len = 0u;
+
+	if (ipv4 != NULL) {
+		self->_a_rr_len = (uint8_t)dns_rr_build(self->_a_rr,
+			sizeof(self->_a_rr), DNS_TYPE_A, ttl_s, ipv4, 4u);
+	}
+
+	if (ipv6 != NULL) {
+		self->_aaaa_rr_len = (uint8_t)dns_rr_build(self->_aaaa_rr,
+			sizeof(self->_aaaa_rr), DNS_TYPE_AAAA, ttl_s, ipv6,
+			16u);
+	}
+
+	self->answered = 0u;
+	self->nodata   = 0u;
+	self->refused  = 0u;
+	self->notimp   = 0u;
+	self->dropped  = 0u;
+}
+
+/** Answers parsed query in place. Returns answer length (raw UDP payload
+ *  length), 0 if query is malformed, is a response (drop it) or answer
+ *  doesn't fit. Counters account only answers actually built */
+static size_t dns_captive_answer(struct dns_captive *self, struct dns_msg *msg)
+{
+	size_t    result = 0u;
+	uint32_t *counter = &self->nodata;
+	uint8_t   opcode = 0u;
+
+	if (msg->malformed == 0u) {
+		opcode = (uint8_t)((msg->_packet_buf[2] >> 3) & 0x0Fu);
+	}
+
+	if (msg->malformed != 0u) {
+		counter = NULL; /* Nothing to answer */
+	} else if ((msg->_packet_buf[2] & 0x80u) != 0u) {
+		self->dropped++;
+		counter = NULL; /* Never answer a response */
+	} else if (opcode != 0u) {
+		result  = dns_msg_answer_rcode(msg, DNS_RCODE_NOTIMP);
+		counter = &self->notimp;
+
+		/* Opcode is echoed */
+		msg->_packet_buf[2] |= (uint8_t)(opcode << 3);
+	} else if (msg->query_class != DNS_CLASS_IN) {
+		result  = dns_msg_answer_rcode(msg, DNS_RCODE_REFUSED);
+		counter = &self->refused;
+	} else if ((msg->query_type == DNS_TYPE_A) &&
+		   (self->_a_rr_len > 0u)) {
+		result  = dns_msg_add_answer(msg, self->_a_rr,
+					     self->_a_rr_len);
+		counter = &self->answered;
+	} else if ((msg->query_type == DNS_TYPE_AAAA) &&
+		   (self->_aaaa_rr_len > 0u)) {
+		result  = dns_msg_add_answer(msg, self->_aaaa_rr,
+					     self->_aaaa_rr_len);
+		counter = &self->answered;
+	} else {
+		result = dns_msg_answer_rcode(msg, DNS_RCODE_NOERROR);
+	}
+
+	if ((result > 0u) && (counter != NULL)) {
+		(*counter)++;
+	}
+
+	return result;
+}
+
+/*****************************************************************************
+ * MULTICAST DNS (mDNS) AND LLMNR
+ *****************************************************************************/
+/** Well known mDNS port (RFC 6762) */
+#define DNS_PORT_MDNS 5353u
+
+/** Well known LLMNR port (RFC 4795) */
+#define DNS_PORT_LLMNR 5355u
+
+/** mDNS question unicast-response (QU) bit and record cache-flush bit,
+ *  both are top bit of class field */
+#define DNS_MDNS_CLASS_BIT 0x8000u
+
+/** Maximum TTL in legacy unicast replies (RFC 6762 section 6.7) */
+#define DNS_MDNS_LEGACY_TTL_MAX_S 10u
+
+/** Maximum number of records in one multicast batch */
+#define DNS_MDNS_BATCH_RECORDS 32u
+
+/** Maximum batch packet size usable with 14 bit compression pointers */
+#define DNS_MDNS_BATCH_CAP_MAX 0x3FFFu
+
+/** Returns true if parsed (first) mDNS question asks for unicast
+ *  response */
+static bool dns_msg_mdns_unicast(struct dns_msg *self)
+{
+	return (self->query_class & DNS_MDNS_CLASS_BIT) != 0u;
+}
+
+/** Returns class of parsed (first) mDNS question without QU bit */
+static uint16_t dns_msg_mdns_class(struct dns_msg *self)
+{
+	return (uint16_t)(self->query_class & (uint16_t)~DNS_MDNS_CLASS_BIT);
+}
+
+/** Skips (possibly compressed) name at `ofs` of parsed message. Returns
+ *  offset past the name, 0 if name is malformed */
+static size_t _dns_msg_name_skip(const struct dns_msg *self, size_t ofs)
+{
+	const uint8_t *p = self->_packet_buf;
+	size_t result = 0u;
+	bool   done = false;
+
+	while (!done && (ofs < self->_packet_len)) {
+		if (p[ofs] == 0u) {
+			result = ofs + 1u;
+			done = true;
+		} else if ((p[ofs] & 0xC0u) == 0xC0u) {
+			result = ((ofs + 2u) <= self->_packet_len) ?
+				 (ofs + 2u) : 0u;
+			done = true;
+		} else if (p[ofs] > 63u) {
+			done = true; /* Reserved label type */
+		} else {
+			ofs += 1u + (size_t)p[ofs];
+		}
+	}
+
+	return result;
+}
+
+/** Reads name at `ofs` of parsed message into uncompressed `wire`, stores
+ *  offset past the name (in place) into `end`. Compression pointers must
+ *  point strictly backwards, so pointer loops are impossible. Returns wire
+ *  name length, 0 if name is malformed or doesn't fit into `cap` */
+static size_t _dns_msg_name_read(const struct dns_msg *self, size_t ofs,
+				 uint8_t *wire, size_t cap, size_t *end)
+{
+	const uint8_t *p = self->_packet_buf;
+	size_t limit = ofs; /* Pointers must point before this offset */
+	size_t len = 0u;
+	bool   ok = true;
+	bool   done = false;
+
+	*end = _dns_msg_name_skip(self, ofs);
+	ok   = (*end > 0u);
+
+	while (ok && !done) {
+		uint8_t c = p[ofs];
+
+		if (c == 0u) {
+			ok = (len < cap);
+
+			if (ok) {
+				wire[len] = 0u;
+				len++;
+			}
+
+			done = true;
+		} else if ((c & 0xC0u) == 0xC0u) {
+			size_t target = 0u;
+
+			ok = ((ofs + 1u) < self->_packet_len);
+
+			if (ok) {
+				target = (((size_t)c & 0x3Fu) << 8) |
+					 (size_t)p[ofs + 1u];
+				ok = (target < limit);
+			}
+
+			limit = target;
+			ofs   = target;
+		} else {
+			ok = (c <= 63u) &&
+			     ((ofs + 1u + (size_t)c) < self->_packet_len) &&
+			     ((len + 1u + (size_t)c) < cap) &&
+			     ((len + 1u + (size_t)c) < DNS_NAME_WIRE_MAX);
+
+			if (ok) {
+				(void)memcpy(&wire[len], &p[ofs],
+					     1u + (size_t)c);
+				len += 1u + (size_t)c;
+				ofs += 1u + (size_t)c;
+			}
+		}
+	}
+
+	return ok ? len : 0u;
+}
+
+/** Returns offset of question `index` of parsed message. `index` equal to
+ *  number of questions gives offset of answer section. 0 if malformed */
+static size_t _dns_msg_question_ofs(const struct dns_msg *self,
+				    uint16_t index)
+{
+	size_t   ofs = 12u;
+	uint16_t i = 0u;
+
+	while ((ofs > 0u) && (i < index)) {
+		ofs = _dns_msg_name_skip(self, ofs);
+
+		if ((ofs == 0u) || ((ofs + 4u) > self->_packet_len)) {
+			ofs = 0u;
+		} else {
+			ofs += 4u;
+		}
+
+		i++;
+	}
+
+	return ofs;
+}
+
+/** Returns number of questions (QDCOUNT) of parsed message. mDNS queries
+ *  often carry several, `dns_msg_parse_query` parses only the first one */
+static uint16_t dns_msg_question_count(const struct dns_msg *self)
+{
+	uint16_t result = 0u;
+
+	if (self->malformed == 0u) {
+		result = (uint16_t)((self->_packet_buf[4] << 8) |
+				    self->_packet_buf[5]);
+	}
+
+	return result;
+}
+
+/** Reads question `index` of parsed message (0 is the parsed one). Name is
+ *  stored uncompressed into `wire`, class keeps mDNS QU bit. Returns wire
+ *  name length, 0 if there is no such question or it's malformed */
+static size_t dns_msg_question(const struct dns_msg *self, uint16_t index,
+			       uint8_t *wire, size_t cap, uint16_t *type,
+			       uint16_t *qclass)
+{
+	const uint8_t *p = self->_packet_buf;
+	size_t ofs = 0u;
+	size_t end = 0u;
+	size_t result = 0u;
+
+	if (index < dns_msg_question_count(self)) {
+		ofs = _dns_msg_question_ofs(self, index);
+	}
+
+	if (ofs > 0u) {
+		result = _dns_msg_name_read(self, ofs, wire, cap, &end);
+	}
+
+	if ((result > 0u) && ((end + 4u) <= self->_packet_len)) {
+		*type   = (uint16_t)((p[end + 0u] << 8) | p[end + 1u]);
+		*qclass = (uint16_t)((p[end + 2u] << 8) | p[end + 3u]);
+	} else {
+		result = 0u;
+	}
+
+	return result;
+}
+
+/** Known-answer suppression (RFC 6762 section 7.1). Walks answer section
+ *  of parsed mDNS query (after all questions) and returns true if our
+ *  record of `type` and `rdata` owned by wire `name` is already known to
+ *  the querier with at least half of our `ttl_s`, so it must not be sent.
+ *  RDATA is compared as is, so records with names inside RDATA match only
+ *  when sent uncompressed */
+static bool dns_msg_mdns_known_answer(const struct dns_msg *self,
+				      const uint8_t *name, size_t name_len,
+				      uint16_t type, const uint8_t *rdata,
+				      uint16_t rdlen, uint32_t ttl_s)
+{
+	const uint8_t *p = self->_packet_buf;
+	uint8_t  owner[DNS_NAME_WIRE_MAX];
+	size_t   owner_len;
+	uint16_t count = 0u;
+	size_t   ofs = 0u;
+	bool     result = false;
+
+	if (self->malformed == 0u) {
+		ofs = _dns_msg_question_ofs(self,
+					    dns_msg_question_count(self));
+	}
+
+	if (ofs > 0u) {
+		count = (uint16_t)((p[6] << 8) | p[7]);
+	}
+
+	while ((count > 0u) && !result) {
+		owner_len = _dns_msg_name_read(self, ofs, owner, sizeof(owner),
+					       &ofs);
+
+		/* type(2) class(2) ttl(4) rdlen(2) rdata */
+		if ((owner_len == 0u) || ((ofs + 10u) > self->_packet_len)) {
+			count = 0u; /* Malformed, stop */
+		} else {
+			const uint8_t *rr = &p[ofs];
+			uint16_t rr_type  = (uint16_t)((rr[0] << 8) | rr[1]);
+			uint32_t rr_ttl_s = ((uint32_t)rr[4] << 24) |
+					    ((uint32_t)rr[5] << 16) |
+					    ((uint32_t)rr[6] << 8) |
+					    ((uint32_t)rr[7] << 0);
+			uint16_t rr_len   = (uint16_t)((rr[8] << 8) | rr[9]);
+
+			ofs += 10u;
+
+			if ((ofs + rr_len) > self->_packet_len) {
+				count = 0u;
+			} else {
+				result = (rr_type == type) &&
+					 (rr_len == rdlen) &&
+					 (rr_ttl_s >= (ttl_s - (ttl_s / 2u))) &&
+					 (memcmp(&p[ofs], rdata, rdlen) == 0) &&
+					 dns_name_eq(owner, owner_len, name,
+						     name_len);
+
+				ofs += rr_len;
+				count--;
+			}
+		}
+	}
+
+	return result;
+}
+
+/** Returns true if mDNS query came from a port other than 5353, so it is
+ *  a legacy unicast query of a plain resolver (RFC 6762 section 6.7) */
+static bool dns_mdns_legacy(const struct dns_msg_ctx *ctx)
+{
+	return ctx->client.port != DNS_PORT_MDNS;
+}
+
+/** Finishes unicast mDNS answer of `len` bytes built with
+ *  `dns_msg_add_answer`, for the query received with `ctx`. Responses
+ *  (QU replies included) get ID 0 and no questions, so the question is cut
+ *  and the answer owns the uncompressed QNAME (RFC 6762 section 18.1).
+ *  Legacy unicast replies keep ID and the first question, and get TTL of
+ *  at most 10 s without cache-flush bit. Records for other questions go
+ *  through the multicast batch. Returns answer length (raw UDP payload
+ *  length), 0 if there is no answer. Message can't be answered again */
+static size_t dns_msg_mdns_finish(struct dns_msg *self, size_t len,
+				  const struct dns_msg_ctx *ctx)
+{
+	uint8_t *p = self->_packet_buf;
+	size_t   rr = self->_ofs; /* Answer RR, after the question */
+	uint32_t ttl_s;
+	size_t   result = 0u;
+
+	if ((self->malformed == 0u) && (p != NULL) && (len >= (rr + 12u))) {
+		p[2] = 0x84; /* Response, authoritative */
+		p[3] = 0x00;
+		p[4] = 0x00;
+		p[5] = 0x00;
+
+		result = len;
+	}
+
+	if (result == 0u) {
+		/* Nothing to finish */
+	} else if (dns_mdns_legacy(ctx)) {
+		ttl_s = ((uint32_t)p[rr + 6u] << 24) |
+			((uint32_t)p[rr + 7u] << 16) |
+			((uint32_t)p[rr + 8u] << 8) |
+			((uint32_t)p[rr + 9u] << 0);
+
+		if (ttl_s > DNS_MDNS_LEGACY_TTL_MAX_S) {
+			ttl_s = DNS_MDNS_LEGACY_TTL_MAX_S;
+		}
+
+		p[5] = 0x01; /* First question only */
+
+		p[rr + 4u] &= (uint8_t)~(DNS_MDNS_CLASS_BIT >> 8);
+		p[rr + 6u]  = (uint8_t)(ttl_s >> 24);
+		p[rr + 7u]  = (uint8_t)(ttl_s >> 16);
+		p[rr + 8u]  = (uint8_t)(ttl_s >> 8);
+		p[rr + 9u]  = (uint8_t)(ttl_s >> 0);
+	} else {
+		p[0] = 0x00;
+		p[1] = 0x00;
+
+		/* QNAME stays as owner, QTYPE, QCLASS and pointer go */
+		(void)memmove(&p[rr - 4u], &p[rr + 2u], len - (rr + 2u));
+		result = len - 6u;
+	}
+
+	return result;
+}
+
+/** Finishes LLMNR answer built with `dns_msg_add_answer`: LLMNR header
+ *  has C/TC/T bits where DNS has AA/TC/RD, and no RA (RFC 4795) */
+static void dns_msg_llmnr_finish(struct dns_msg *self)
+{
+	if ((self->malformed == 0u) && (self->_packet_buf != NULL)) {
+		self->_packet_buf[2] = 0x80; /* Response, not tentative */
+		self->_packet_buf[3] = 0x00;
+		self->_packet_buf[4] = 0x00;
+		self->_packet_buf[5] = 0x01; /* First question only */
+	}
+}
+
+/** Multicast mDNS response batch. Answers to a burst of queries (often
+ *  the same question from hundreds of hosts) are aggregated into a single
+ *  multicast packet: duplicate records are added only once, repeated owner
+ *  names are compressed, and the packet goes out when full or when the
+ *  first record waited `delay_ms` (RFC 6762 allows up to 500 ms) */
+struct dns_mdns_batch {
+	uint8_t *_buf; /**< Packet buffer (caller storage) */
+	size_t   _cap; /**< Packet buffer capacity (MTU payload) */
+	size_t   len;  /**< Packet length */
+
+	/** Offsets of record owner names and of record type field */
+	uint16_t _name_ofs[DNS_MDNS_BATCH_RECORDS];
+	uint16_t _rr_ofs[DNS_MDNS_BATCH_RECORDS];
+	uint16_t records; /**< Number of records in packet */
+
+	uint32_t delay_ms; /**< Maximum aggregation delay */
+	uint32_t wait_ms;  /**< Time first record waits */
+
+	uint32_t duplicates; /**< Number of suppressed duplicate records */
+};
+
+/** Starts empty batch packet */
+static void _dns_mdns_batch_reset(struct dns_mdns_batch *self)
+{
+	(void)memset(self->_buf, 0, 12u);
+	self->_buf[2] = 0x84; /* Response, authoritative, ID 0 */
+
+	self->len     = 12u;
+	self->records = 0u;
+	self->wait_ms = 0u;
+}
+
+/** Initializes batch over packet buffer */
+static void dns_mdns_batch_init(struct dns_mdns_batch *self, uint8_t *buf,
+				size_t cap, uint32_t delay_ms)
+{
+	self->_buf = buf;
+	self->_cap = ((buf != NULL) && (cap >= 12u)) ? cap : 0u;
+
+	/* Compression pointers address only first 0x3FFF bytes */
+	if (self->_cap > DNS_MDNS_BATCH_CAP_MAX) {
+		self->_cap = DNS_MDNS_BATCH_CAP_MAX;
+	}
+
+	self->delay_ms   = delay_ms;
+	self->duplicates = 0u;
+
+	self->len     = 0u;
+	self->records = 0u;
+	self->wait_ms = 0u;
+
+	if (self->_cap > 0u) {
+		_dns_mdns_batch_reset(self);
+	}
+}
+
+/** Adds record (class IN) owned by wire `name`. `cache_flush` marks
+ *  unique record. Returns false if batch is full, flush and add again */
+static bool dns_mdns_batch_add(struct dns_mdns_batch *self,
+			       const uint8_t *name, size_t name_len,
+			       uint16_t type, bool cache_flush, uint32_t ttl_s,
+			       const uint8_t *rdata, uint16_t rdlen)
+{
+	uint8_t  rr[12u];
+	uint16_t rr_class = (uint16_t)(DNS_CLASS_IN |
+				       (cache_flush ? DNS_MDNS_CLASS_BIT : 0u));
+	uint16_t name_ptr = 0u;
+	uint16_t i;
+	bool     dup = false;
+	bool     result = false;
+	size_t   need;
+
+	/* Same owner already in packet: compress or detect duplicate */
+	for (i = 0u; (i < self->records) && !dup; i++) {
+		const uint8_t *n = &self->_buf[self->_name_ofs[i]];
+		const uint8_t *r = &self->_buf[self->_rr_ofs[i]];
+
+		if (dns_name_eq(n, dns_name_wire_len(n, name_len), name,
+				name_len)) {
+			name_ptr = self->_name_ofs[i];
+
+			dup = ((((uint16_t)r[0] << 8) | r[1]) == type) &&
+			      ((((uint16_t)r[8] << 8) | r[9]) == rdlen) &&
+			      (memcmp(&r[10], rdata, rdlen) == 0);
+		}
+	}
+
+	need = ((name_ptr > 0u) ? 2u : name_len) + 10u + (size_t)rdlen;
+
+	if (dup) {
+		self->duplicates++;
+		result = true;
+	} else if ((self->_cap == 0u) ||
+		   (self->records >= DNS_MDNS_BATCH_RECORDS) ||
+		   ((self->len + need) > self->_cap)) {
+		/* Full */
+	} else {
+		if (name_ptr > 0u) {
+			/* Owner offset always points to uncompressed name */
+			self->_name_ofs[self->records] = name_ptr;
+			self->_buf[self->len + 0u] =
+				(uint8_t)(0xC0u | (name_ptr >> 8));
+			self->_buf[self->len + 1u] = (uint8_t)name_ptr;
+			self->len += 2u;
+		} else {
+			self->_name_ofs[self->records] = (uint16_t)self->len;
+			(void)memcpy(&self->_buf[self->len], name, name_len);
+			self->len += name_len;
+		}
+
+		/* Reuse RR builder, skip its QNAME pointer */
+		(void)dns_rr_build(rr, sizeof(rr), type, ttl_s, NULL, 0u);
+		rr[4]  = (uint8_t)(rr_class >> 8);
+		rr[5]  = (uint8_t)(rr_class >> 0);
+		rr[10] = (uint8_t)(rdlen >> 8);
+		rr[11] = (uint8_t)(rdlen >> 0);
+
+		self->_rr_ofs[self->records] = (uint16_t)self->len;
+		(void)memcpy(&self->_buf[self->len], &rr[2], 10u);
+		self->len += 10u;
+
+		if (rdlen > 0u) {
+			(void)memcpy(&self->_buf[self->len], rdata, rdlen);
+			self->len += rdlen;
+		}
+
+		self->records++;
+		self->_buf[6] = (uint8_t)(self->records >> 8);
+		self->_buf[7] = (uint8_t)(self->records >> 0);
+
+		result = true;
+	}
+
+	return result;
+}
+
+/** Advances batch timer. Returns true if batch should be sent now */
+static bool dns_mdns_batch_tick(struct dns_mdns_batch *self,
+				uint32_t delta_ms)
+{
+	if (self->records > 0u) {
+		self->wait_ms += delta_ms;
+	}
+
+	return (self->records > 0u) && (self->wait_ms >= self->delay_ms);
+}
+
+/** Takes batch packet for multicast send. Returns packet length (0 if
+ *  batch is empty). Packet must be sent before next record is added */
+static size_t dns_mdns_batch_flush(struct dns_mdns_batch *self)
+{
+	size_t result = 0u;
+
+	if (self->records > 0u) {
+		result = self->len;
+		_dns_mdns_batch_reset(self);
+	}
+
+	return result;
+}
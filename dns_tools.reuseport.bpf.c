@@ -0,0 +1,79 @@
+/**
+ * @file dns_tools.reuseport.bpf.c
+ * @brief SO_ATTACH_REUSEPORT_EBPF selector steering queries by QNAME hash
+ *
+ * Every worker owns one UDP socket of the same SO_REUSEPORT group. The
+ * selector hashes QNAME exactly like `dns_msg_qname_hash` and picks the
+ * worker like `dns_worker_select`, so each worker cache shard sees its
+ * own consistent subset of names. Packets it can't parse get default
+ * (4-tuple hash) selection. Loaded by `dns_reuseport_attach`
+ * (dns_tools.reuseport.c).
+ *
+ * Build: `make bpf` (clang -O2 -g -target bpf)
+ */
+
+#include <linux/bpf.h>
+#include <linux/udp.h>
+#include <bpf/bpf_helpers.h>
+
+#include "dns_tools.bpf.h"
+
+/** DNS header, QNAME, QTYPE and QCLASS */
+#define DNS_REUSEPORT_BUF_LEN (12u + DNS_BPF_NAME_MAX + 4u)
+
+/** Worker sockets, index is worker number */
+struct {
+	__uint(type, BPF_MAP_TYPE_REUSEPORT_SOCKARRAY);
+	__uint(max_entries, DNS_BPF_WORKERS_MAX);
+	__type(key, __u32);
+	__type(value, __u32);
+} dns_workers SEC(".maps");
+
+/** Number of workers (single entry) */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1u);
+	__type(key, __u32);
+	__type(value, __u32);
+} dns_worker_count SEC(".maps");
+
+SEC("sk_reuseport")
+int dns_reuseport_select(struct sk_reuseport_md *ctx)
+{
+	__u8  buf[DNS_REUSEPORT_BUF_LEN];
+	__u8  name[DNS_BPF_NAME_MAX];
+	__u32 zero = 0u;
+	__u32 *workers;
+	__u32 hash = 0u;
+	__u32 index;
+	__u32 len;
+
+	/* Payload starts after UDP header */
+	len = (ctx->len > sizeof(struct udphdr)) ?
+	      (ctx->len - sizeof(struct udphdr)) : 0u;
+
+	if (len > DNS_REUSEPORT_BUF_LEN) {
+		len = DNS_REUSEPORT_BUF_LEN;
+	}
+
+	workers = bpf_map_lookup_elem(&dns_worker_count, &zero);
+
+	if ((workers == NULL) || (*workers == 0u) ||
+	    (*workers > DNS_BPF_WORKERS_MAX) || (len <= 12u) ||
+	    (bpf_skb_load_bytes(ctx, sizeof(struct udphdr), buf, len) != 0)) {
+		return SK_PASS;
+	}
+
+	if (dns_bpf_qname(&buf[12], &buf[len], name, &hash) == 0u) {
+		return SK_PASS;
+	}
+
+	/* Multiply-shift, like `dns_worker_select` */
+	index = (__u32)(((__u64)hash * *workers) >> 32);
+
+	(void)bpf_sk_select_reuseport(ctx, &dns_workers, &index, 0u);
+
+	return SK_PASS;
+}
+
+char _license[] SEC("license") = "Dual BSD/GPL";
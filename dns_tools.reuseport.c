@@ -0,0 +1,90 @@
+/**
+ * @file dns_tools.reuseport.c
+ * @brief Loader of the QNAME hash reuseport selector (binding layer)
+ *
+ * Attaches dns_tools.reuseport.bpf.c to a SO_REUSEPORT group of worker
+ * sockets, so queries are steered to workers by QNAME hash instead of by
+ * 4-tuple. Needs libbpf 1.0 or newer. Build: `make bpf`.
+ */
+
+#include <sys/socket.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "dns_tools.h"
+#include "dns_tools.bpf.h"
+
+#ifndef SO_ATTACH_REUSEPORT_EBPF
+#define SO_ATTACH_REUSEPORT_EBPF 52
+#endif
+
+/* BPF program must hash and select exactly like dns_tools.h */
+typedef char dns_reuseport_layout_check[
+	((DNS_BPF_HASH_BASIS == DNS_HASH_BASIS) &&
+	 (DNS_BPF_HASH_PRIME == DNS_HASH_PRIME) &&
+	 (DNS_BPF_NAME_MAX == DNS_QNAME_WIRE_MAX) &&
+	 (DNS_BPF_PORT == DNS_PORT)) ? 1 : -1];
+
+/** Loads selector object at `path` and attaches it to the group of
+ *  `workers` sockets `fds` (UDP sockets, one per worker in worker order,
+ *  already bound to the same address with SO_REUSEPORT). Returns loaded
+ *  object, keep it while sockets are open and release with
+ *  `bpf_object__close`. Returns NULL on error */
+struct bpf_object *dns_reuseport_attach(const char *path, const int *fds,
+					uint32_t workers)
+{
+	struct bpf_object  *obj = NULL;
+	struct bpf_program *prog = NULL;
+	int      sock_map = -1;
+	int      count_map = -1;
+	int      prog_fd = -1;
+	uint32_t zero = 0u;
+	uint32_t fd;
+	uint32_t i;
+	bool     ok = (fds != NULL) && (workers > 0u) &&
+		      (workers <= DNS_BPF_WORKERS_MAX);
+
+	if (ok) {
+		obj = bpf_object__open_file(path, NULL);
+		ok  = (obj != NULL) && (bpf_object__load(obj) == 0);
+	}
+
+	if (ok) {
+		prog      = bpf_object__find_program_by_name(obj,
+						"dns_reuseport_select");
+		sock_map  = bpf_object__find_map_fd_by_name(obj, "dns_workers");
+		count_map = bpf_object__find_map_fd_by_name(obj,
+						"dns_worker_count");
+
+		ok = (prog != NULL) && (sock_map >= 0) && (count_map >= 0);
+	}
+
+	if (ok) {
+		prog_fd = bpf_program__fd(prog);
+		ok = (prog_fd >= 0);
+	}
+
+	for (i = 0u; ok && (i < workers); i++) {
+		fd = (uint32_t)fds[i];
+		ok = (bpf_map_update_elem(sock_map, &i, &fd, BPF_ANY) == 0);
+	}
+
+	if (ok) {
+		ok = (bpf_map_update_elem(count_map, &zero, &workers,
+					  BPF_ANY) == 0);
+	}
+
+	/* Program is shared by the whole group, attach via any socket */
+	if (ok) {
+		ok = (setsockopt(fds[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_EBPF,
+				 &prog_fd, sizeof(prog_fd)) == 0);
+	}
+
+	if (!ok && (obj != NULL)) {
+		bpf_object__close(obj);
+		obj = NULL;
+	}
+
+	return obj;
+}
@@ -57,8 +57,1874 @@ void test_dns_parsing_standard(void)
 	}
 }
 
+void test_dns_edns_answer(void)
+{
+	struct dns_msg msg;
+	uint8_t pkt[128];
+	uint8_t answer[] = {
+		0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c,
+		0x00, 0x04, 0x07, 0x07, 0x07, 0x07
+	};
+	/* EDNS OPT record: root name, type 41, 4096 bytes payload */
+	uint8_t opt[] = {
+		0x00, 0x00, 0x29, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+	};
+	size_t len;
+
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	(void)memcpy(&pkt[sizeof(sample_query)], opt, sizeof(opt));
+	pkt[11] = 1u; /* ARCOUNT */
+
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query) + sizeof(opt));
+	assert(msg.malformed == 0u);
+
+	/* Answer overwrites the OPT record, so it must not be advertised */
+	len = dns_msg_add_answer(&msg, answer, sizeof(answer));
+	assert(len == (sizeof(sample_query) + sizeof(answer)));
+	assert((pkt[6] == 0u) && (pkt[7] == 1u));
+	assert((pkt[8] == 0u) && (pkt[9] == 0u));
+	assert((pkt[10] == 0u) && (pkt[11] == 0u));
+
+	printf("Test Passed: EDNS query answer counts\n");
+}
+
+void test_dns_stream_pipelining(void)
+{
+	struct dns_stream stream;
+	struct dns_msg msg;
+	uint8_t buf[128];
+	uint8_t wire[2u * (2u + sizeof(sample_query))];
+	size_t wire_len = 0u;
+	size_t ofs = 0u;
+	size_t answer_len;
+	size_t sent_len;
+	uint8_t answer[] = {
+		0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c,
+		0x00, 0x04, 0x07, 0x07, 0x07, 0x07
+	};
+	uint8_t n = 0u;
+
+	/* Two length prefixed queries back to back (pipelined) */
+	for (n = 0u; n < 2u; n++) {
+		wire[wire_len++] = 0u;
+		wire[wire_len++] = (uint8_t)sizeof(sample_query);
+		(void)memcpy(&wire[wire_len], sample_query,
+			     sizeof(sample_query));
+		wire_len += sizeof(sample_query);
+	}
+
+	dns_stream_init(&stream, buf, sizeof(buf));
+
+	n = 0u;
+	while (ofs < wire_len) {
+		/* Feed in small chunks, like TLS records may arrive */
+		size_t chunk = ((wire_len - ofs) < 5u) ? (wire_len - ofs) : 5u;
+
+		ofs += dns_stream_write(&stream, &wire[ofs], chunk);
+		assert(stream.malformed == 0u);
+
+		if (dns_stream_msg_ready(&stream)) {
+			dns_msg_init(&msg, dns_stream_msg(&stream),
+				     dns_stream_msg_cap(&stream));
+			dns_msg_parse_query(&msg, dns_stream_msg_len(&stream));
+			assert(msg.malformed == 0u);
+			assert(strcmp(msg.name, "accounts.youtube.com") == 0);
+
+			answer_len = dns_msg_add_answer(&msg, answer,
+							sizeof(answer));
+			sent_len = dns_stream_frame(&stream, answer_len);
+			assert(sent_len == (answer_len + 2u));
+			assert(((buf[0] << 8) | buf[1]) == (int)answer_len);
+
+			dns_stream_next(&stream);
+			n++;
+		}
+	}
+
+	assert(n == 2u);
+	assert(stream.messages == 2u);
+
+	/* Writes while message is ready don't count it again */
+	dns_stream_init(&stream, buf, sizeof(buf));
+	assert(dns_stream_write(&stream, wire, wire_len) ==
+	       (2u + sizeof(sample_query)));
+	assert(dns_stream_write(&stream, wire, 0u) == 0u);
+	assert(dns_stream_write(&stream, wire, wire_len) == 0u);
+	assert(stream.messages == 1u);
+
+	/* Zero length message is a protocol violation */
+	dns_stream_init(&stream, buf, sizeof(buf));
+	wire[0] = 0u;
+	wire[1] = 0u;
+	(void)dns_stream_write(&stream, wire, 2u);
+	assert(stream.malformed != 0u);
+
+	dns_stream_tick(&stream, 1000u);
+	assert(stream.idle_ms == 1000u);
+
+	printf("Test Passed: stream framing and pipelining\n");
+}
+
+/* Mock TLS backend: no encryption, transport is a byte script delivered a
+ * few bytes per call, full handshake takes two calls, resumed one */
+struct test_tls {
+	struct dns_tls_session_cache *cache;
+	const uint8_t *in;
+	size_t in_len;
+	size_t in_ofs;
+	uint8_t out[256];
+	size_t out_len;
+	uint8_t id[4];   /* Session ID offered by the client */
+	uint32_t now_s;
+	uint8_t rounds;  /* Handshake calls */
+	uint8_t writes;  /* Write calls, every other one stalls */
+	bool resumed;
+};
+
+uint8_t test_tls_handshake(void *tls)
+{
+	struct test_tls *t = tls;
+	const uint8_t *state;
+	size_t len;
+	uint8_t result = DNS_TLS_OK;
+
+	t->rounds++;
+
+	if (t->rounds == 1u) {
+		/* ClientHello: resume if the session is known */
+		state = dns_tls_session_get(t->cache, t->id, sizeof(t->id),
+					    t->now_s, &len);
+		t->resumed = (state != NULL) && (len == 6u) &&
+			     (memcmp(state, "secret", 6u) == 0);
+		result = t->resumed ? DNS_TLS_OK : DNS_TLS_AGAIN;
+	} else {
+		(void)dns_tls_session_put(t->cache, t->id, sizeof(t->id),
+					  (const uint8_t *)"secret", 6u,
+					  t->now_s);
+	}
+
+	return result;
+}
+
+uint8_t test_tls_read(void *tls, uint8_t *buf, size_t cap, size_t *len)
+{
+	struct test_tls *t = tls;
+	size_t n = t->in_len - t->in_ofs;
+
+	n = (n < cap) ? n : cap;
+	n = (n < 5u) ? n : 5u;
+
+	(void)memcpy(buf, &t->in[t->in_ofs], n);
+	t->in_ofs += n;
+	*len = n;
+
+	return (n > 0u) ? DNS_TLS_OK : DNS_TLS_AGAIN;
+}
+
+uint8_t test_tls_write(void *tls, const uint8_t *buf, size_t len,
+		       size_t *written)
+{
+	struct test_tls *t = tls;
+	size_t n = (len < 7u) ? len : 7u;
+	uint8_t result = DNS_TLS_OK;
+
+	t->writes++;
+
+	if ((t->writes & 1u) == 0u) {
+		n = 0u;
+		result = DNS_TLS_AGAIN;
+	}
+
+	assert((t->out_len + n) <= sizeof(t->out));
+	(void)memcpy(&t->out[t->out_len], buf, n);
+	t->out_len += n;
+	*written = n;
+
+	return result;
+}
+
+bool test_tls_resumed(void *tls)
+{
+	return ((struct test_tls *)tls)->resumed;
+}
+
+const struct dns_tls_ops test_tls_ops = {
+	test_tls_handshake, test_tls_read, test_tls_write, test_tls_resumed
+};
+
+/* Serves connection until the script is exhausted, returns answers sent */
+uint32_t test_dot_serve(struct test_tls *tls, const uint8_t *in,
+			size_t in_len, uint32_t now_s, uint8_t *state)
+{
+	struct dns_dot dot;
+	struct dns_msg msg;
+	uint8_t buf[128];
+	uint8_t answer[] = {
+		0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c,
+		0x00, 0x04, 0x07, 0x07, 0x07, 0x07
+	};
+	uint32_t answers = 0u;
+	size_t len;
+	uint8_t i;
+
+	tls->in      = in;
+	tls->in_len  = in_len;
+	tls->in_ofs  = 0u;
+	tls->out_len = 0u;
+	tls->now_s   = now_s;
+	tls->rounds  = 0u;
+	tls->writes  = 0u;
+	tls->resumed = false;
+
+	dns_dot_init(&dot, &test_tls_ops, tls, buf, sizeof(buf));
+
+	/* Socket is "ready" on every iteration */
+	for (i = 0u; i < 64u; i++) {
+		*state = dns_dot_poll(&dot);
+
+		if (*state == DNS_DOT_QUERY) {
+			dns_msg_init(&msg, dns_stream_msg(&dot.stream),
+				     dns_stream_msg_cap(&dot.stream));
+			dns_msg_parse_query(&msg,
+					    dns_stream_msg_len(&dot.stream));
+			assert(msg.malformed == 0u);
+
+			len = dns_msg_add_answer(&msg, answer, sizeof(answer));
+			*state = dns_dot_answer(&dot, len);
+			answers++;
+		}
+	}
+
+	assert(dot.resumed == tls->resumed);
+
+	return answers;
+}
+
+void test_dns_dot(void)
+{
+	struct dns_tls_session entries[4];
+	struct dns_tls_session_cache cache;
+	struct test_tls tls;
+	uint8_t wire[2u * (2u + sizeof(sample_query))];
+	uint8_t bad[] = { 0x00, 0x00 };
+	size_t wire_len = 0u;
+	size_t answer_len = sizeof(sample_query) + 16u;
+	size_t len;
+	uint8_t state;
+	uint8_t n;
+
+	for (n = 0u; n < 2u; n++) {
+		wire[wire_len++] = 0u;
+		wire[wire_len++] = (uint8_t)sizeof(sample_query);
+		(void)memcpy(&wire[wire_len], sample_query,
+			     sizeof(sample_query));
+		wire_len += sizeof(sample_query);
+	}
+
+	dns_tls_session_cache_init(&cache, entries, 3u, 60u);
+	assert(cache.malformed != 0u);
+
+	dns_tls_session_cache_init(&cache, entries, 4u, 60u);
+	assert(cache.malformed == 0u);
+
+	(void)memset(&tls, 0, sizeof(tls));
+	tls.cache = &cache;
+	(void)memcpy(tls.id, "\x01\x02\x03\x04", 4u);
+
+	/* Full handshake once, then both pipelined queries answered in
+	 * order through partial, stalled writes */
+	assert(test_dot_serve(&tls, wire, wire_len, 0u, &state) == 2u);
+	assert(state == DNS_DOT_READ);
+	assert((tls.rounds == 2u) && !tls.resumed);
+	assert(tls.out_len == (2u * (2u + answer_len)));
+	assert(((tls.out[0] << 8) | tls.out[1]) == (int)answer_len);
+	assert(memcmp(&tls.out[2], &tls.out[4u + answer_len],
+		      answer_len) == 0);
+	assert((cache.hits == 0u) && (cache.misses == 1u));
+
+	/* Returning client resumes it's session */
+	assert(test_dot_serve(&tls, wire, wire_len, 59u, &state) == 2u);
+	assert((tls.rounds == 1u) && tls.resumed);
+	assert(cache.hits == 1u);
+
+	/* Expired session takes full handshake again (and is renewed) */
+	assert(test_dot_serve(&tls, wire, wire_len, 60u, &state) == 2u);
+	assert((tls.rounds == 2u) && !tls.resumed);
+	assert(cache.misses == 2u);
+
+	assert(dns_tls_session_get(&cache, tls.id, 4u, 61u, &len) != NULL);
+	assert(len == 6u);
+	dns_tls_session_remove(&cache, tls.id, 4u);
+	assert(dns_tls_session_get(&cache, tls.id, 4u, 61u, &len) == NULL);
+	assert(!dns_tls_session_put(&cache, tls.id, 0u, wire, 1u, 0u));
+
+	/* Zero length message closes the connection */
+	assert(test_dot_serve(&tls, bad, sizeof(bad), 0u, &state) == 0u);
+	assert(state == DNS_DOT_CLOSED);
+
+	printf("Test Passed: DoT over TLS backend, session resumption\n");
+}
+
+void test_dns_doh(void)
+{
+	struct dns_msg msg;
+	uint8_t body[128];
+	char target[] = "/dns-query?ct=x&dns=AAABAAAB&other=1";
+	char *param;
+	size_t param_len;
+
+	(void)memcpy(body, sample_query, sizeof(sample_query));
+
+	/* POST body is parsed in place */
+	assert(dns_doh_post(&msg, "application/dns-message", body,
+			    sizeof(sample_query), sizeof(body)));
+	assert(msg._packet_buf == body);
+	assert(strcmp(msg.name, "accounts.youtube.com") == 0);
+
+	assert(dns_doh_media_type_ok("Application/DNS-Message; charset=x"));
+	assert(!dns_doh_media_type_ok("application/dns-messages"));
+	assert(!dns_doh_post(&msg, "text/plain", body,
+			     sizeof(sample_query), sizeof(body)));
+
+	param = dns_doh_get_param(target, strlen(target), &param_len);
+	assert(param != NULL);
+	assert(param_len == 8u);
+	assert(memcmp(param, "AAABAAAB", 8u) == 0);
+
+	param = dns_doh_get_param(target, 10u, &param_len);
+	assert(param == NULL);
+
+	printf("Test Passed: DoH POST and GET parameter\n");
+}
+
+/** Char at a time base64url decoder, reference for the block decoder */
+size_t test_b64url_scalar(uint8_t *dst, const char *src, size_t len)
+{
+	const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+			       "abcdefghijklmnopqrstuvwxyz0123456789-_";
+	const char *c;
+	uint32_t bits = 0u;
+	size_t nbits = 0u;
+	size_t result = 0u;
+	size_t i;
+	bool ok = ((len & 3u) != 1u);
+
+	for (i = 0u; ok && (i < len); i++) {
+		c  = (src[i] != '\0') ? strchr(alphabet, src[i]) : NULL;
+		ok = (c != NULL);
+
+		if (ok) {
+			bits = (bits << 6) | (uint32_t)(c - alphabet);
+			nbits += 6u;
+		}
+
+		if (ok && (nbits >= 8u)) {
+			nbits -= 8u;
+			dst[result] = (uint8_t)(bits >> nbits);
+			result++;
+		}
+	}
+
+	return ok ? result : 0u;
+}
+
+void test_dns_b64url(void)
+{
+	struct dns_msg msg;
+	uint8_t out[8];
+	uint8_t ref[64];
+	uint8_t got[64];
+	char text[80];
+	const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+			       "abcdefghijklmnopqrstuvwxyz0123456789-_";
+	uint32_t rng = 1u;
+	size_t len;
+	size_t bad;
+	size_t n;
+	size_t i;
+	/* www.example.com A query from RFC 8484 section 4.1.1 */
+	char target[] = "/dns-query?dns="
+		"AAABAAABAAAAAAAAA3d3dwdleGFtcGxlA2NvbQAAAQAB";
+
+	assert(dns_b64url_decode(out, sizeof(out), "AQID", 4u) == 3u);
+	assert((out[0] == 1u) && (out[1] == 2u) && (out[2] == 3u));
+	assert(dns_b64url_decode(out, sizeof(out), "_-8", 3u) == 2u);
+	assert((out[0] == 0xffu) && (out[1] == 0xefu));
+	assert(dns_b64url_decode(out, sizeof(out), "AQ==", 4u) == 1u);
+	assert(dns_b64url_decode(out, sizeof(out), "A+ID", 4u) == 0u);
+	assert(dns_b64url_decode(out, sizeof(out), "AQIDB", 5u) == 0u);
+	assert(dns_b64url_decode(out, 2u, "AQID", 4u) == 0u);
+
+	/* Every length and invalid char position agrees with char at a time
+	 * decoding (blocks of 8, of 4 and tail) */
+	for (len = 0u; len <= 72u; len++) {
+		for (i = 0u; i < len; i++) {
+			rng = (rng * 1103515245u) + 12345u;
+			text[i] = alphabet[(rng >> 16) & 63u];
+		}
+
+		for (bad = 0u; bad <= len; bad++) {
+			if (bad < len) {
+				text[bad] = (bad & 1u) ? '+' : (char)0xC3;
+			}
+
+			n = test_b64url_scalar(ref, text, len);
+			assert(dns_b64url_decode(got, sizeof(got), text,
+						 len) == n);
+			assert(memcmp(got, ref, n) == 0);
+			assert((bad == len) || (n == 0u));
+
+			if (bad < len) {
+				text[bad] = alphabet[bad & 63u];
+			}
+		}
+	}
+
+	/* Decoded in place, right over the request target */
+	assert(dns_doh_get(&msg, target, strlen(target), (uint8_t *)target,
+			   sizeof(target)));
+	assert(strcmp(msg.name, "www.example.com") == 0);
+	assert(msg.query_type == 1u);
+
+	printf("Test Passed: base64url decoding\n");
+}
+
+void test_dns_proxy_v2(void)
+{
+	struct dns_msg_ctx ctx;
+	uint32_t malformed = 0u;
+	uint8_t hdr[] = {
+		0x0D, 0x0A, 0x0D, 0x0A, 0x00, 0x0D, 0x0A, 0x51,
+		0x55, 0x49, 0x54, 0x0A,
+		0x21, 0x11, 0x00, 0x0C,  /* PROXY, TCP over IPv4, 12 bytes */
+		192, 0, 2, 1,            /* Source */
+		198, 51, 100, 1,         /* Destination */
+		0xC0, 0x00, 0x03, 0x55,  /* Ports 49152 and 853 */
+		0x00, 0x17               /* First stream bytes */
+	};
+
+	dns_msg_ctx_init(&ctx, DNS_TRANSPORT_DOT, 2u, 1000u);
+
+	/* Incomplete header asks for more bytes */
+	assert(dns_proxy_v2_parse(&ctx, hdr, 20u, &malformed) == 0u);
+	assert(malformed == 0u);
+
+	assert(dns_proxy_v2_parse(&ctx, hdr, sizeof(hdr), &malformed) == 28u);
+	assert(malformed == 0u);
+	assert(ctx.client.family == DNS_ADDR_IPV4);
+	assert(ctx.client.bytes[0] == 192u);
+	assert(ctx.client.port == 49152u);
+	assert(ctx.local.port == DNS_PORT_DOT);
+	assert(ctx.transport == DNS_TRANSPORT_DOT);
+	assert(ctx.rx_time_ns == 1000u);
+
+	/* Plain stream data is not a PROXY header */
+	(void)dns_proxy_v2_parse(&ctx, sample_query, sizeof(sample_query),
+				 &malformed);
+	assert(malformed != 0u);
+
+	printf("Test Passed: PROXY v2 header\n");
+}
+
+void test_dns_latency(void)
+{
+	struct dns_latency lat;
+	struct dns_msg_ctx ctx;
+	uint32_t i;
+
+	dns_latency_init(&lat);
+	dns_msg_ctx_init(&ctx, DNS_TRANSPORT_UDP, 0u, 0u);
+
+	/* No kernel timestamp */
+	dns_latency_record(&lat, &ctx, 5000u);
+	assert(lat.unknown == 1u);
+
+	dns_msg_ctx_set_rx_time(&ctx, 10u, 0u);
+
+	/* 99 fast answers (~20us) and one slow (~5ms, kernel queueing) */
+	for (i = 0u; i < 99u; i++) {
+		dns_latency_record(&lat, &ctx, ctx.rx_time_ns + 20000u);
+	}
+
+	dns_latency_record(&lat, &ctx, ctx.rx_time_ns + 5000000u);
+
+	assert(lat.count == 100u);
+	assert(lat.max_ns == 5000000u);
+	assert(dns_latency_percentile(&lat, 500u) == 32767u);
+	assert(dns_latency_percentile(&lat, 990u) == 32767u);
+	assert(dns_latency_percentile(&lat, 1000u) == 8388607u);
+
+	printf("Test Passed: latency accounting\n");
+}
+
+void test_dns_admission(void)
+{
+	struct dns_admission adm;
+	struct dns_msg msg;
+	const uint8_t *cookie;
+	size_t cookie_len;
+	uint8_t i;
+	/* TXT query with EDNS client cookie */
+	uint8_t pkt[] = {
+		0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x01,
+		0x01, 'a', 0x02, 'b', 'c', 0x00,
+		0x00, 0x10, 0x00, 0x01,             /* TXT, IN */
+		0x00, 0x00, 0x29, 0x04, 0xd0,       /* OPT, udp 1232 */
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, /* ttl, rdlen */
+		0x00, 0x0a, 0x00, 0x08,             /* COOKIE, 8 bytes */
+		1, 2, 3, 4, 5, 6, 7, 8
+	};
+
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(pkt));
+	assert(msg.malformed == 0u);
+
+	cookie = dns_msg_get_cookie(&msg, &cookie_len);
+	assert((cookie != NULL) && (cookie_len == 8u) && (cookie[7] == 8u));
+
+	assert(dns_msg_get_prio(&msg, false, true) == DNS_PRIO_ANY_TXT);
+	assert(dns_msg_get_prio(&msg, true, false) == DNS_PRIO_COOKIE);
+
+	dns_msg_init(&msg, sample_query, sizeof(sample_query));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	assert(dns_msg_get_cookie(&msg, &cookie_len) == NULL);
+	assert(dns_msg_get_prio(&msg, false, false) == DNS_PRIO_UNKNOWN);
+	assert(dns_msg_get_prio(&msg, false, true) == DNS_PRIO_NO_COOKIE);
+
+	dns_admission_init(&adm, 64u, 1000u);
+	dns_admission_update(&adm, 10u, 100u);
+	assert(adm.level == 0u);
+	assert(dns_admission_admit(&adm, DNS_PRIO_ANY_TXT));
+
+	/* Sustained overload sheds lowest priorities first */
+	dns_admission_update(&adm, 64u, 100u);
+	assert(adm.level == 1u);
+	assert(!dns_admission_admit(&adm, DNS_PRIO_ANY_TXT));
+	assert(dns_admission_admit(&adm, DNS_PRIO_UNKNOWN));
+
+	for (i = 0u; i < 8u; i++) {
+		dns_admission_update(&adm, 100u, 100u);
+	}
+
+	assert(adm.level == DNS_PRIO_COOKIE);
+	assert(!dns_admission_admit(&adm, DNS_PRIO_NO_COOKIE));
+	assert(dns_admission_admit(&adm, DNS_PRIO_COOKIE));
+
+	/* Recovery once load drops */
+	for (i = 0u; i < 8u; i++) {
+		dns_admission_update(&adm, 0u, 0u);
+	}
+
+	assert(adm.level == 0u);
+	assert(adm.shed == 2u);
+
+	printf("Test Passed: admission control\n");
+}
+
+void test_dns_cpu_map(void)
+{
+	struct dns_cpu_map map;
+
+	/* Simulated NIC: 4 RX queues with IRQs on CPUs 2, 3, 6 and 7 */
+	dns_cpu_map_init(&map);
+	assert(dns_cpu_map_add_queue(&map, 2u) == 0u);
+	assert(dns_cpu_map_add_queue(&map, 3u) == 1u);
+	assert(dns_cpu_map_add_queue(&map, 6u) == 2u);
+	assert(dns_cpu_map_add_queue(&map, 7u) == 3u);
+	assert(map.malformed == 0u);
+
+	assert(dns_cpu_map_worker_cpu(&map, 2u) == 6u);
+	assert(dns_cpu_map_worker_cpu(&map, 4u) == DNS_CPU_NONE);
+
+	assert(dns_cpu_map_select(&map, 7u) == 3u);
+	assert(dns_cpu_map_select(&map, 5u) == 1u); /* 5 % 4 */
+
+	/* Same IRQ CPU twice is a configuration error */
+	(void)dns_cpu_map_add_queue(&map, 2u);
+	assert(map.malformed != 0u);
+
+	assert(dns_sock_buf_size(100000u, 10u, 256u) == (1000u * 1024u));
+
+	printf("Test Passed: CPU affinity map\n");
+}
+
+void test_dns_worker_steering(void)
+{
+	struct dns_msg msg;
+	uint8_t upper[sizeof(sample_query)];
+	uint32_t hash;
+	uint32_t i;
+
+	dns_msg_init(&msg, sample_query, sizeof(sample_query));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	assert(msg._qname_len == 22u);
+	hash = dns_msg_qname_hash(&msg);
+
+	/* Case must not change the worker */
+	(void)memcpy(upper, sample_query, sizeof(upper));
+	upper[13] = 'A';
+	upper[22] = 'Y';
+	dns_msg_init(&msg, upper, sizeof(upper));
+	dns_msg_parse_query(&msg, sizeof(upper));
+	assert(dns_msg_qname_hash(&msg) == hash);
+
+	for (i = 1u; i < 64u; i++) {
+		assert(dns_worker_select(hash, i) < i);
+	}
+
+	assert(dns_worker_select(0xFFFFFFFFu, 8u) == 7u);
+	assert(dns_worker_select(0u, 8u) == 0u);
+
+	printf("Test Passed: QNAME hash worker steering\n");
+}
+
+void test_dns_hot_table(void)
+{
+	struct dns_hot_table hot;
+	struct dns_hot_entry entries[8];
+	struct dns_msg msg;
+	uint8_t pkt[128];
+	uint8_t ip4[] = { 7, 7, 7, 7 };
+	uint8_t name[] = {
+		8, 'A', 'c', 'c', 'o', 'u', 'n', 't', 's',
+		7, 'y', 'o', 'u', 't', 'u', 'b', 'e', 3, 'c', 'o', 'm', 0
+	};
+	size_t len;
+
+	dns_hot_init(&hot, entries, 8u);
+	assert(dns_hot_add(&hot, name, sizeof(name), DNS_TYPE_A, 60u,
+			   ip4, sizeof(ip4)));
+	assert(hot.len == 1u);
+
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+
+	len = dns_hot_answer(&hot, &msg);
+	assert(len == (sizeof(sample_query) + 16u));
+	assert((pkt[7] == 1u) && (pkt[11] == 0u));
+	assert((pkt[sizeof(sample_query)] == 0xC0u) &&
+	       (pkt[sizeof(sample_query) + 1u] == 0x0Cu));
+	assert(pkt[len - 1u] == 7u);
+
+	/* AAAA for the same name is not hot */
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	pkt[sizeof(sample_query) - 3u] = DNS_TYPE_AAAA;
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	assert(dns_hot_answer(&hot, &msg) == 0u);
+
+	assert((hot.hits == 1u) && (hot.misses == 1u));
+
+	printf("Test Passed: hot record fast path\n");
+}
+
+void test_dns_busy_poll(void)
+{
+	struct dns_busy_poll bp;
+	uint32_t i;
+
+	dns_busy_poll_init(&bp, 100u, 50u);
+
+	for (i = 0u; i < 100u; i++) {
+		assert(dns_busy_poll_update(&bp, 0u) == 0u);
+	}
+
+	assert(dns_busy_poll_update(&bp, 0u) == 1u);
+	assert(dns_busy_poll_update(&bp, 0u) == 2u);
+
+	for (i = 0u; i < 10u; i++) {
+		(void)dns_busy_poll_update(&bp, 0u);
+	}
+
+	assert(bp.pause_us == 50u);
+
+	/* Traffic resumes: spin again right away */
+	assert(dns_busy_poll_update(&bp, 32u) == 0u);
+	assert(dns_busy_poll_update(&bp, 0u) == 0u);
+	assert(bp.polls == 114u);
+
+	/* Maximum of 0 keeps pausing disabled, 1 caps right away */
+	dns_busy_poll_init(&bp, 2u, 0u);
+
+	for (i = 0u; i < 8u; i++) {
+		assert(dns_busy_poll_update(&bp, 0u) == 0u);
+	}
+
+	dns_busy_poll_init(&bp, 0u, 1u);
+
+	for (i = 0u; i < 4u; i++) {
+		assert(dns_busy_poll_update(&bp, 0u) == 1u);
+	}
+
+	printf("Test Passed: busy polling backoff\n");
+}
+
+void test_dns_0x20(void)
+{
+	struct dns_msg msg;
+	uint8_t pkt[sizeof(sample_query)];
+	uint8_t reply[sizeof(sample_query)];
+	uint32_t rng = 0x12345678u;
+	size_t i;
+	bool changed = false;
+
+	(void)memcpy(pkt, sample_query, sizeof(pkt));
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(pkt));
+
+	dns_msg_0x20_randomize(&msg, &rng);
+
+	for (i = 0u; i < sizeof(pkt); i++) {
+		if (pkt[i] != sample_query[i]) {
+			changed = true;
+			assert((pkt[i] ^ sample_query[i]) == 0x20u);
+		}
+	}
+
+	assert(changed);
+	assert(strcmp(msg.name, "accounts.youtube.com") == 0);
+
+	/* Echoed query (QR clear) is rejected */
+	(void)memcpy(reply, pkt, sizeof(reply));
+	assert(!dns_msg_0x20_verify(&msg, reply, sizeof(reply)));
+
+	/* Spoofed reply with one case bit flipped is rejected */
+	reply[2] = 0x81u;
+	reply[13] ^= 0x20u;
+	assert(!dns_msg_0x20_verify(&msg, reply, sizeof(reply)));
+	reply[13] ^= 0x20u;
+
+	/* Reply to another type is rejected */
+	reply[sizeof(reply) - 3u] = DNS_TYPE_AAAA;
+	assert(!dns_msg_0x20_verify(&msg, reply, sizeof(reply)));
+	reply[sizeof(reply) - 3u] = DNS_TYPE_A;
+
+	/* Upstream echoes randomised case */
+	assert(dns_msg_0x20_verify(&msg, reply, sizeof(reply)));
+
+	/* Client gets it's own case back */
+	dns_msg_0x20_restore(&msg, reply);
+	assert(memcmp(&reply[12], &sample_query[12], 22u) == 0);
+
+	printf("Test Passed: 0x20 case randomisation\n");
+}
+
+void test_dns_name_primitives(void)
+{
+	uint8_t a[DNS_NAME_WIRE_MAX];
+	uint8_t b[DNS_NAME_WIRE_MAX];
+	size_t a_len;
+	size_t b_len;
+	const char *order[] = {
+		/* RFC 4034 section 6.1 example, canonical order */
+		"example.", "a.example.", "yljkjljk.a.example.",
+		"Z.a.example.", "zABC.a.EXAMPLE.", "z.example.",
+		"*.z.example."
+	};
+	size_t i;
+
+	a_len = dns_name_from_str("WWW.Example.com", a, sizeof(a));
+	b_len = dns_name_from_str("www.example.COM.", b, sizeof(b));
+	assert((a_len == 17u) && (b_len == 17u));
+	assert((a[0] == 3u) && (a[4] == 7u) && (a[12] == 3u) && (a[16] == 0u));
+	assert(dns_name_wire_len(a, a_len) == a_len);
+	assert(dns_name_eq(a, a_len, b, b_len));
+
+	b[2] = 'x';
+	assert(!dns_name_eq(a, a_len, b, b_len));
+
+	/* Subdomain checks respect label boundaries */
+	b_len = dns_name_from_str("example.com", b, sizeof(b));
+	assert(dns_name_is_subdomain(a, a_len, b, b_len));
+	assert(dns_name_is_subdomain(b, b_len, b, b_len));
+	assert(!dns_name_is_subdomain(b, b_len, a, a_len));
+	b_len = dns_name_from_str("ample.com", b, sizeof(b));
+	assert(!dns_name_is_subdomain(a, a_len, b, b_len));
+	b_len = dns_name_from_str(".", b, sizeof(b));
+	assert((b_len == 1u) && dns_name_is_subdomain(a, a_len, b, b_len));
+
+	for (i = 1u; i < (sizeof(order) / sizeof(order[0])); i++) {
+		a_len = dns_name_from_str(order[i - 1u], a, sizeof(a));
+		b_len = dns_name_from_str(order[i], b, sizeof(b));
+		assert(dns_name_canonical_cmp(a, a_len, b, b_len) < 0);
+		assert(dns_name_canonical_cmp(b, b_len, a, a_len) > 0);
+	}
+
+	assert(dns_name_canonical_cmp(a, a_len, a, a_len) == 0);
+
+	assert(dns_name_from_str("a..b", a, sizeof(a)) == 0u);
+	assert(dns_name_from_str("abc", a, 4u) == 0u);
+	assert(dns_name_from_str("abc", a, 5u) == 5u);
+
+	printf("Test Passed: wire name primitives\n");
+}
+
+void test_dns_name_index(void)
+{
+	struct dns_name_index idx;
+	struct dns_name_index_entry entries[200];
+	struct dns_name_index_node nodes[80];
+	uint8_t keys[4096];
+	static uint8_t names[200][24];
+	size_t names_len[200];
+	uint8_t q[DNS_NAME_WIRE_MAX];
+	size_t q_len;
+	uint32_t i;
+	uint32_t j;
+	uint32_t best;
+	char str[16];
+	/* Zone names, loaded out of order */
+	const char *zone[] = {
+		"z.example.", "example.", "*.z.example.", "a.example.",
+		"zABC.a.example.", "yljkjljk.a.example."
+	};
+	const struct dns_name_index_entry *e;
+
+	dns_name_index_init(&idx, entries, 8u, nodes, 80u, keys, sizeof(keys));
+
+	for (i = 0u; i < 6u; i++) {
+		size_t len = dns_name_from_str(zone[i], names[i], 24u);
+		assert(dns_name_index_add(&idx, names[i], len, i));
+	}
+
+	/* Keys are in canonical order, octets 0x00 and 0x01 included */
+	q_len = dns_name_from_str("a", q, sizeof(q));
+	assert(_dns_name_key(q, q_len, keys + 3072) == 2u);
+	q[1] = 0u;
+	assert(_dns_name_key(q, q_len, keys + 3072) == 3u);
+	assert(memcmp(keys + 3072, "\x01\x01\x00", 3u) == 0);
+	assert(_dns_name_key(q, q_len - 1u, keys + 3072) == 0u);
+
+	/* Existing name */
+	q_len = dns_name_from_str("A.example", q, sizeof(q));
+	e = dns_name_index_get(&idx, dns_name_index_find_le(&idx, q, q_len));
+	assert((e != NULL) && (e->value == 3u));
+
+	/* Nonexistent name is covered by NSEC of it's predecessor */
+	q_len = dns_name_from_str("b.example", q, sizeof(q));
+	e = dns_name_index_get(&idx, dns_name_index_find_le(&idx, q, q_len));
+	assert((e != NULL) && (e->value == 4u)); /* zABC.a.example */
+
+	/* Name before apex wraps around to the last name */
+	q_len = dns_name_from_str("com", q, sizeof(q));
+	e = dns_name_index_get(&idx, dns_name_index_find_le(&idx, q, q_len));
+	assert((e != NULL) && (e->value == 2u)); /* *.z.example */
+
+	/* Same name again replaces it's value */
+	q_len = dns_name_from_str("Z.EXAMPLE", q, sizeof(q));
+	assert(dns_name_index_add(&idx, q, q_len, 9u));
+	assert(idx.len == 6u);
+	e = dns_name_index_get(&idx, dns_name_index_find_le(&idx, q, q_len));
+	assert((e != NULL) && (e->value == 9u));
+
+	/* Many names in scattered order: tree grows several levels and every
+	 * lookup in between matches a brute force predecessor search */
+	dns_name_index_init(&idx, entries, 200u, nodes, 80u, keys,
+			    sizeof(keys));
+
+	for (i = 0u; i < 200u; i++) {
+		j = (i * 67u) % 200u;
+		(void)sprintf(str, "n%u.example", (unsigned)(j * 5u));
+		names_len[i] = dns_name_from_str(str, names[i], 24u);
+		assert(dns_name_index_add(&idx, names[i], names_len[i], i));
+
+		(void)sprintf(str, "n%u.example", (unsigned)((j * 5u) + 2u));
+		q_len = dns_name_from_str(str, q, sizeof(q));
+		best = DNS_INDEX_NONE;
+
+		for (j = 0u; j <= i; j++) {
+			if ((dns_name_canonical_cmp(names[j], names_len[j],
+						    q, q_len) <= 0) &&
+			    ((best == DNS_INDEX_NONE) ||
+			     (dns_name_canonical_cmp(names[best],
+						     names_len[best],
+						     names[j],
+						     names_len[j]) < 0))) {
+				best = j;
+			}
+		}
+
+		assert(dns_name_index_find_le(&idx, q, q_len) == best);
+	}
+
+	assert(idx.nodes_len <= ((200u / 3u) + 16u));
+
+	for (i = 0u; i < 200u; i++) {
+		assert(dns_name_index_find_le(&idx, names[i], names_len[i]) ==
+		       i);
+	}
+
+	/* Full index refuses more names and stays intact */
+	q_len = dns_name_from_str("n1.example", q, sizeof(q));
+	assert(!dns_name_index_add(&idx, q, q_len, 0u));
+	assert(idx.malformed != 0u);
+	assert(dns_name_index_find_le(&idx, names[0], names_len[0]) == 0u);
+
+	printf("Test Passed: ordered name index\n");
+}
+
+void test_dns_suffix_tree(void)
+{
+	struct dns_suffix_tree tree;
+	struct dns_suffix_node nodes[32];
+	uint8_t labels[256];
+	uint8_t name[DNS_NAME_WIRE_MAX];
+	size_t len;
+	uint32_t node;
+	uint32_t top;
+	uint8_t depth;
+	uint32_t count;
+	const char *names[] = {
+		"ads.example.com", "tracker.net", "Example.COM", "a.b.c.d"
+	};
+	uint32_t i;
+
+	dns_suffix_tree_init(&tree, nodes, 32u, labels, sizeof(labels));
+
+	for (i = 0u; i < 4u; i++) {
+		len = dns_name_from_str(names[i], name, sizeof(name));
+		assert(dns_suffix_tree_insert(&tree, name, len, 100u + i) !=
+		       DNS_INDEX_NONE);
+	}
+
+	/* ads.example.com, example.com, com, tracker.net, net, a.b.c.d ... */
+	assert(tree.len == 9u);
+	assert(tree.malformed == 0u);
+
+	/* Exact */
+	len = dns_name_from_str("EXAMPLE.com", name, sizeof(name));
+	node = dns_suffix_tree_find(&tree, name, len);
+	assert(dns_suffix_tree_value(&tree, node) == 102u);
+	len = dns_name_from_str("b.c.d", name, sizeof(name));
+	assert(dns_suffix_tree_find(&tree, name, len) == DNS_INDEX_NONE);
+	len = dns_name_from_str("x.a.b.c.d", name, sizeof(name));
+	assert(dns_suffix_tree_find(&tree, name, len) == DNS_INDEX_NONE);
+
+	/* Longest suffix */
+	len = dns_name_from_str("x.ads.example.com", name, sizeof(name));
+	node = dns_suffix_tree_longest(&tree, name, len, DNS_SUFFIX_TERM,
+				       &depth);
+	assert((dns_suffix_tree_value(&tree, node) == 100u) && (depth == 3u));
+	len = dns_name_from_str("www.example.com", name, sizeof(name));
+	node = dns_suffix_tree_longest(&tree, name, len, DNS_SUFFIX_TERM,
+				       &depth);
+	assert((dns_suffix_tree_value(&tree, node) == 102u) && (depth == 2u));
+	assert(dns_suffix_tree_match(&tree, name, len));
+	len = dns_name_from_str("example.org", name, sizeof(name));
+	assert(!dns_suffix_tree_match(&tree, name, len));
+
+	/* Subtree: every inserted name under com */
+	len = dns_name_from_str("com", name, sizeof(name));
+	top = dns_suffix_tree_longest(&tree, name, len, DNS_SUFFIX_USED, NULL);
+	count = 0u;
+
+	for (node = dns_suffix_tree_next(&tree, top, top);
+	     node != DNS_INDEX_NONE;
+	     node = dns_suffix_tree_next(&tree, top, node)) {
+		if ((nodes[node].flags & DNS_SUFFIX_TERM) != 0u) {
+			count++;
+		}
+	}
+
+	assert(count == 2u);
+
+	/* Name back from node */
+	len = dns_name_from_str("ads.example.com", name, sizeof(name));
+	node = dns_suffix_tree_find(&tree, name, len);
+	assert(dns_suffix_tree_name(&tree, node, name, sizeof(name)) == len);
+	assert(memcmp(name, "\003ads\007example\003com", len) == 0);
+
+	printf("Test Passed: suffix tree\n");
+}
+
+uint8_t test_zone_lookup(struct dns_suffix_tree *tree, const char *str,
+			 uint16_t qtype, uint32_t *value)
+{
+	uint8_t name[DNS_NAME_WIRE_MAX];
+	size_t len = dns_name_from_str(str, name, sizeof(name));
+	uint32_t node;
+	uint8_t result = dns_zone_lookup(tree, name, len, qtype, &node);
+
+	*value = dns_suffix_tree_value(tree, node);
+
+	return result;
+}
+
+void test_dns_zone_lookup(void)
+{
+	struct dns_suffix_tree tree;
+	struct dns_suffix_node nodes[64];
+	uint8_t labels[512];
+	uint8_t name[DNS_NAME_WIRE_MAX];
+	uint32_t value;
+	uint32_t i;
+	struct {
+		const char *name;
+		uint8_t flags;
+	} zone[] = {
+		{ "tld",                 DNS_SUFFIX_APEX },
+		{ "shop.tld",            DNS_SUFFIX_CUT  },
+		{ "bank.tld",            DNS_SUFFIX_CUT  },
+		{ "bank.tld",            DNS_SUFFIX_APEX }, /* Hosted too */
+		{ "www.bank.tld",        0u },
+		{ "*.wild.tld",          0u },
+		{ "a.b.c.tld",           0u }
+	};
+
+	dns_suffix_tree_init(&tree, nodes, 64u, labels, sizeof(labels));
+
+	for (i = 0u; i < (sizeof(zone) / sizeof(zone[0])); i++) {
+		size_t len = dns_name_from_str(zone[i].name, name,
+					       sizeof(name));
+		assert(dns_zone_add(&tree, name, len, i, zone[i].flags) !=
+		       DNS_INDEX_NONE);
+	}
+
+	assert(test_zone_lookup(&tree, "TLD", DNS_TYPE_A, &value) ==
+	       DNS_ZONE_ANSWER);
+	assert(value == 0u);
+	assert(test_zone_lookup(&tree, "x.y.shop.tld", DNS_TYPE_A, &value) ==
+	       DNS_ZONE_REFERRAL);
+	assert(value == 1u);
+	assert(test_zone_lookup(&tree, "www.bank.tld", DNS_TYPE_A, &value) ==
+	       DNS_ZONE_ANSWER);
+	assert(value == 4u);
+	assert(test_zone_lookup(&tree, "foo.wild.tld", DNS_TYPE_A, &value) ==
+	       DNS_ZONE_WILDCARD);
+	assert(value == 5u);
+	assert(test_zone_lookup(&tree, "b.c.tld", DNS_TYPE_A, &value) ==
+	       DNS_ZONE_NODATA);
+	assert(test_zone_lookup(&tree, "x.c.tld", DNS_TYPE_A, &value) ==
+	       DNS_ZONE_NXDOMAIN);
+	assert(test_zone_lookup(&tree, "example.org", DNS_TYPE_A, &value) ==
+	       DNS_ZONE_REFUSED);
+
+	/* DS at a cut is answered by the parent, below it is referred */
+	assert(test_zone_lookup(&tree, "shop.tld", DNS_TYPE_A, &value) ==
+	       DNS_ZONE_REFERRAL);
+	assert(test_zone_lookup(&tree, "shop.tld", DNS_TYPE_DS, &value) ==
+	       DNS_ZONE_ANSWER);
+	assert(value == 1u);
+	assert(test_zone_lookup(&tree, "x.shop.tld", DNS_TYPE_DS, &value) ==
+	       DNS_ZONE_REFERRAL);
+	assert(test_zone_lookup(&tree, "bank.tld", DNS_TYPE_DS, &value) ==
+	       DNS_ZONE_ANSWER);
+	assert(test_zone_lookup(&tree, "www.bank.tld", DNS_TYPE_DS,
+				&value) == DNS_ZONE_ANSWER);
+	assert(value == 4u);
+
+	printf("Test Passed: zone lookup with zone cuts\n");
+}
+
+void test_dns_zone_index(void)
+{
+	struct dns_suffix_tree index;
+	struct dns_suffix_node nodes[64];
+	uint8_t labels[256];
+	uint8_t name[DNS_NAME_WIRE_MAX];
+	struct dns_msg msg;
+	uint32_t node;
+	uint8_t depth;
+	uint32_t i;
+	const char *zones[] = {
+		"youtube.com", "accounts.youtube.com", "google.com", "us"
+	};
+
+	dns_suffix_tree_init(&index, nodes, 64u, labels, sizeof(labels));
+
+	for (i = 0u; i < 4u; i++) {
+		size_t len = dns_name_from_str(zones[i], name, sizeof(name));
+		assert(dns_zone_index_add(&index, name, len, 1000u + i) !=
+		       DNS_INDEX_NONE);
+	}
+
+	dns_msg_init(&msg, sample_query, sizeof(sample_query));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	assert(msg._label_count == 3u);
+	assert((msg._label_ofs[1] == 9u) && (msg._label_ofs[2] == 17u));
+
+	/* Deepest hosted zone wins */
+	node = dns_zone_index_find(&index, &msg, &depth);
+	assert(dns_suffix_tree_value(&index, node) == 1001u);
+	assert(depth == 3u);
+
+	dns_msg_init(&msg, sample_query2, sizeof(sample_query2));
+	dns_msg_parse_query(&msg, sizeof(sample_query2));
+	node = dns_zone_index_find(&index, &msg, &depth);
+	assert(dns_suffix_tree_value(&index, node) == 1003u);
+	assert(depth == 1u);
+
+	/* Not hosted */
+	index._nodes[node].flags &= (uint8_t)~DNS_SUFFIX_APEX;
+	assert(dns_zone_index_find(&index, &msg, NULL) == DNS_INDEX_NONE);
+
+	printf("Test Passed: multi-zone index\n");
+}
+
+void test_dns_any(void)
+{
+	struct dns_msg msg;
+	uint8_t pkt[128];
+	size_t len;
+
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	assert(dns_msg_answer_any(&msg) == 0u);
+
+	pkt[sizeof(sample_query) - 3u] = DNS_TYPE_ANY;
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	assert(strcmp(dns_msg_get_type_str(&msg), "ANY") == 0);
+
+	len = dns_msg_answer_any(&msg);
+	assert(len == (sizeof(sample_query) + 12u + 9u));
+	assert(pkt[7] == 1u);
+	assert(pkt[sizeof(sample_query) + 3u] == DNS_TYPE_HINFO);
+	assert(memcmp(&pkt[sizeof(sample_query) + 13u], "RFC8482", 7u) == 0);
+
+	/* CH and ANY class queries get no IN record */
+	pkt[sizeof(sample_query) - 1u] = 3u;
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	assert((msg.malformed == 0u) && (msg.query_type == DNS_TYPE_ANY));
+	assert(dns_msg_answer_any(&msg) == 0u);
+
+	pkt[sizeof(sample_query) - 1u] = 255u;
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	assert(dns_msg_answer_any(&msg) == 0u);
+
+	printf("Test Passed: ANY minimisation\n");
+}
+
+void test_dns_amp_guard(void)
+{
+	struct dns_amp_guard guard;
+	struct dns_amp_entry entries[16];
+	struct dns_msg_ctx ctx;
+	struct dns_msg msg;
+	uint8_t pkt[128];
+	uint8_t ip4[] = { 203, 0, 113, 7 };
+	uint8_t key_a[] = { DNS_ADDR_IPV4, 10, 0x41, 1, 0, 0, 0, 0 };
+	uint8_t key_b[] = { DNS_ADDR_IPV4, 10, 0x61, 1, 0, 0, 0, 0 };
+	uint32_t i;
+
+	dns_amp_guard_init(&guard, entries, 16u, 4u, 10u);
+	dns_msg_ctx_init(&ctx, DNS_TRANSPORT_UDP, 0u, 0u);
+	dns_addr_set(&ctx.client, ip4, sizeof(ip4), 5353u);
+
+	/* 40 byte queries, 100 byte answers: ratio 2.5 is fine */
+	for (i = 0u; i < 10u; i++) {
+		assert(!dns_amp_guard_check(&guard, &ctx, 40u, 100u, false,
+					    100u));
+	}
+
+	/* 4000 byte answer is cut */
+	assert(dns_amp_guard_check(&guard, &ctx, 40u, 4000u, false, 100u));
+	assert(guard.truncated == 1u);
+
+	/* Unless client is verified, or window is new */
+	assert(!dns_amp_guard_check(&guard, &ctx, 40u, 4000u, true, 100u));
+	assert(!dns_amp_guard_check(&guard, &ctx, 1000u, 4000u, false, 110u));
+
+	/* Binary prefix keys are not case folded: 10.65.1/24 and 10.97.1/24
+	 * hash apart */
+	assert(dns_hash_bytes(key_a, sizeof(key_a)) !=
+	       dns_hash_bytes(key_b, sizeof(key_b)));
+
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	assert(dns_msg_truncate(&msg) == sizeof(sample_query));
+	assert((pkt[2] & 0x02u) != 0u);
+	assert(pkt[7] == 0u);
+
+	printf("Test Passed: amplification guard\n");
+}
+
+void test_dns_acl(void)
+{
+	struct dns_acl acl;
+	struct dns_prefix_node entries[8];
+	struct dns_addr addr;
+	struct dns_msg msg;
+	uint8_t pkt[128];
+	uint8_t net10[]  = { 10, 0, 0, 0 };
+	uint8_t net10x[] = { 10, 1, 128, 0 };
+	uint8_t host[]   = { 10, 1, 200, 5 };
+	uint8_t v6[16]   = { 0x20, 0x01, 0x0d, 0xb8 };
+	uint8_t cls;
+
+	dns_acl_init(&acl, entries, 8u, DNS_ACL_ALLOW);
+
+	dns_addr_set(&addr, net10, 4u, 0u);
+	assert(dns_acl_add(&acl, &addr, 8u, DNS_ACL_REFUSE, 0u));
+	dns_addr_set(&addr, host, 4u, 0u);
+	assert(dns_acl_add(&acl, &addr, 32u, DNS_ACL_ALLOW, 0u));
+	dns_addr_set(&addr, net10x, 4u, 0u);
+	assert(dns_acl_add(&acl, &addr, 17u, DNS_ACL_RATE_LIMIT, 2u));
+	dns_addr_set(&addr, v6, 16u, 0u);
+	assert(dns_acl_add(&acl, &addr, 32u, DNS_ACL_DROP, 0u));
+
+	assert(acl.prefixes.len == 4u);
+
+	dns_addr_set(&addr, host, 4u, 0u);
+	assert(dns_acl_eval(&acl, &addr, &cls) == DNS_ACL_ALLOW);
+	host[3] = 6u; /* 10.1.200.6 in 10.1.128.0/17 */
+	dns_addr_set(&addr, host, 4u, 0u);
+	assert(dns_acl_eval(&acl, &addr, &cls) == DNS_ACL_RATE_LIMIT);
+	assert(cls == 2u);
+	host[2] = 1u; /* 10.1.1.6 only in 10.0.0.0/8 */
+	dns_addr_set(&addr, host, 4u, 0u);
+	assert(dns_acl_eval(&acl, &addr, NULL) == DNS_ACL_REFUSE);
+	v6[15] = 1u;
+	dns_addr_set(&addr, v6, 16u, 0u);
+	assert(dns_acl_eval(&acl, &addr, NULL) == DNS_ACL_DROP);
+	v6[3] = 0u;
+	dns_addr_set(&addr, v6, 16u, 0u);
+	assert(dns_acl_eval(&acl, &addr, NULL) == DNS_ACL_ALLOW);
+
+	/* 10.1.64.0/18 splits from 10.1.128.0/17 under branch 10.1.0.0/16 */
+	net10x[2] = 64u;
+	dns_addr_set(&addr, net10x, 4u, 0u);
+	assert(dns_acl_add(&acl, &addr, 18u, DNS_ACL_RATE_LIMIT, 1u));
+	assert(acl.prefixes.len == 6u);
+	assert(entries[4].prefix_len == 16u);
+	net10x[3] = 1u;
+	dns_addr_set(&addr, net10x, 4u, 0u);
+	assert(dns_acl_eval(&acl, &addr, &cls) == DNS_ACL_RATE_LIMIT);
+	assert(cls == 1u);
+
+	/* Branch node isn't a prefix: 10.1.1.6 matches only 10/8 */
+	dns_addr_set(&addr, host, 4u, 0u);
+	assert(dns_acl_eval(&acl, &addr, NULL) == DNS_ACL_REFUSE);
+
+	/* Same prefix again replaces action in place */
+	dns_addr_set(&addr, net10, 4u, 0u);
+	assert(dns_acl_add(&acl, &addr, 8u, DNS_ACL_DROP, 0u));
+	assert(acl.prefixes.len == 6u);
+	dns_addr_set(&addr, host, 4u, 0u);
+	assert(dns_acl_eval(&acl, &addr, NULL) == DNS_ACL_DROP);
+
+	/* Branch node becomes prefix without new nodes */
+	assert(dns_acl_add(&acl, &addr, 16u, DNS_ACL_REFUSE, 0u));
+	assert(acl.prefixes.len == 6u);
+	assert(dns_acl_eval(&acl, &addr, NULL) == DNS_ACL_REFUSE);
+
+	/* Prefix between existing nodes */
+	assert(dns_acl_add(&acl, &addr, 12u, DNS_ACL_ALLOW, 0u));
+	assert(acl.prefixes.len == 7u);
+	net10[1] = 9u; /* 10.9.0.0 in 10.0.0.0/12 */
+	dns_addr_set(&addr, net10, 4u, 0u);
+	assert(dns_acl_eval(&acl, &addr, NULL) == DNS_ACL_ALLOW);
+
+	/* Split needs two nodes, only one is left: trie stays intact */
+	dns_addr_set(&addr, host, 4u, 0u);
+	assert(!dns_acl_add(&acl, &addr, 24u, DNS_ACL_DROP, 0u));
+	assert(acl.prefixes.malformed != 0u);
+	assert(acl.prefixes.len == 7u);
+	assert(dns_acl_eval(&acl, &addr, NULL) == DNS_ACL_REFUSE);
+	dns_addr_set(&addr, net10x, 4u, 0u);
+	assert(dns_acl_add(&acl, &addr, 20u, DNS_ACL_DROP, 0u));
+	assert(acl.prefixes.len == 8u);
+	assert(dns_acl_eval(&acl, &addr, NULL) == DNS_ACL_DROP);
+
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	assert(dns_msg_answer_rcode(&msg, DNS_RCODE_REFUSED) ==
+	       sizeof(sample_query));
+	assert((pkt[3] & 0x0Fu) == DNS_RCODE_REFUSED);
+
+	printf("Test Passed: client ACL\n");
+}
+
+void test_dns_rpz(void)
+{
+	struct dns_suffix_tree qname;
+	struct dns_suffix_node nodes[64];
+	uint8_t labels[256];
+	struct dns_suffix_tree overlay;
+	struct dns_suffix_node overlay_nodes[16];
+	uint8_t overlay_labels[64];
+	struct dns_feed qname_feed;
+	struct dns_prefix_trie client_ip;
+	struct dns_prefix_node ip_nodes[4];
+	struct dns_rpz rpz;
+	struct dns_msg_ctx ctx;
+	struct dns_msg msg;
+	uint8_t name[DNS_NAME_WIRE_MAX];
+	uint8_t pkt[128];
+	uint8_t rr[DNS_HOT_RR_MAX];
+	uint8_t sinkhole[] = { 127, 0, 0, 1 };
+	uint8_t bad_client[] = { 192, 0, 2, 66 };
+	uint8_t bad_net[] = { 198, 51, 100, 0 };
+	uint32_t data;
+	size_t len;
+
+	dns_suffix_tree_init(&qname, nodes, 64u, labels, sizeof(labels));
+	len = dns_name_from_str("*.youtube.com", name, sizeof(name));
+	assert(dns_rpz_add_name(&qname, name, len, DNS_RPZ_LOCAL_DATA, 7u) !=
+	       DNS_INDEX_NONE);
+	len = dns_name_from_str("accounts.youtube.com", name, sizeof(name));
+	assert(dns_rpz_add_name(&qname, name, len, DNS_RPZ_PASSTHRU, 0u) !=
+	       DNS_INDEX_NONE);
+	len = dns_name_from_str("*.us", name, sizeof(name));
+	assert(dns_rpz_add_name(&qname, name, len, DNS_RPZ_NXDOMAIN, 0u) !=
+	       DNS_INDEX_NONE);
+
+	dns_prefix_trie_init(&client_ip, ip_nodes, 4u);
+	dns_msg_ctx_init(&ctx, DNS_TRANSPORT_UDP, 0u, 0u);
+	dns_addr_set(&ctx.client, bad_net, 4u, 0u);
+	assert(dns_rpz_add_ip(&client_ip, &ctx.client, 24u,
+			      DNS_RPZ_LOCAL_DATA, 9u));
+	dns_addr_set(&ctx.client, bad_client, 4u, 0u);
+	assert(dns_rpz_add_ip(&client_ip, &ctx.client, 32u, DNS_RPZ_DROP, 0u));
+
+	dns_suffix_tree_init(&overlay, overlay_nodes, 16u, overlay_labels,
+			     sizeof(overlay_labels));
+	dns_feed_init(&qname_feed, &qname, &overlay);
+
+	/* Same feed doubles as NSDNAME and response IP triggers here */
+	dns_rpz_init(&rpz, &qname_feed, &qname_feed, &client_ip, &client_ip);
+
+	/* Exact passthru wins over wildcard */
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	assert(dns_rpz_eval_query(&rpz, &ctx, &msg, &data) == DNS_RPZ_DROP);
+	ctx.client.bytes[3] = 1u;
+	assert(dns_rpz_eval_query(&rpz, &ctx, &msg, &data) ==
+	       DNS_RPZ_PASSTHRU);
+
+	/* Wildcard: local data */
+	len = dns_name_from_str("m.youtube.com", name, sizeof(name));
+	assert(_dns_rpz_match(&qname_feed, name, len) ==
+	       DNS_RPZ_VALUE(DNS_RPZ_LOCAL_DATA, 7u));
+	len = dns_name_from_str("youtube.com", name, sizeof(name));
+	assert(_dns_rpz_match(&qname_feed, name, len) == DNS_RPZ_NONE);
+
+	/* Wildcard: NXDOMAIN */
+	(void)memcpy(pkt, sample_query2, sizeof(sample_query2));
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query2));
+	assert(dns_rpz_eval_query(&rpz, &ctx, &msg, &data) ==
+	       DNS_RPZ_NXDOMAIN);
+	len = dns_rpz_apply(&msg, DNS_RPZ_NXDOMAIN, NULL, 0u);
+	assert(len == 38u);
+	assert((pkt[3] & 0x0Fu) == DNS_RCODE_NXDOMAIN);
+
+	/* Local data answer */
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	len = dns_rr_build(rr, sizeof(rr), DNS_TYPE_A, 60u, sinkhole, 4u);
+	assert(dns_rpz_apply(&msg, DNS_RPZ_LOCAL_DATA, rr, len) ==
+	       (sizeof(sample_query) + len));
+
+	len = dns_name_from_str("ns1.shelljacket.us", name, sizeof(name));
+	assert(dns_rpz_eval_nsdname(&rpz, name, len, &data) ==
+	       DNS_RPZ_NXDOMAIN);
+	dns_addr_set(&ctx.client, bad_client, 4u, 0u);
+	assert(dns_rpz_eval_response_ip(&rpz, &ctx.client, NULL) ==
+	       DNS_RPZ_DROP);
+
+	/* IP triggers carry local data too */
+	bad_net[3] = 7u;
+	dns_addr_set(&ctx.client, bad_net, 4u, 0u);
+	assert(dns_rpz_eval_response_ip(&rpz, &ctx.client, &data) ==
+	       DNS_RPZ_LOCAL_DATA);
+	assert(data == 9u);
+
+	assert(rpz.hits == 6u);
+
+	/* Deltas: removed exact trigger falls back to wildcard */
+	len = dns_name_from_str("accounts.youtube.com", name, sizeof(name));
+	assert(dns_feed_remove(&qname_feed, name, len));
+	assert(_dns_rpz_match(&qname_feed, name, len) ==
+	       DNS_RPZ_VALUE(DNS_RPZ_LOCAL_DATA, 7u));
+
+	/* Removed wildcard, deeper wildcard added */
+	len = dns_name_from_str("*.youtube.com", name, sizeof(name));
+	assert(dns_feed_remove(&qname_feed, name, len));
+	len = dns_name_from_str("*.m.youtube.com", name, sizeof(name));
+	assert(dns_feed_add(&qname_feed, name, len,
+			    DNS_RPZ_VALUE(DNS_RPZ_NODATA, 0u)));
+	len = dns_name_from_str("m.youtube.com", name, sizeof(name));
+	assert(_dns_rpz_match(&qname_feed, name, len) == DNS_RPZ_NONE);
+	len = dns_name_from_str("x.m.youtube.com", name, sizeof(name));
+	assert(_dns_rpz_match(&qname_feed, name, len) ==
+	       DNS_RPZ_VALUE(DNS_RPZ_NODATA, 0u));
+
+	/* IP trigger removed in place */
+	dns_addr_set(&ctx.client, bad_client, 4u, 0u);
+	assert(dns_prefix_trie_remove(&client_ip, &ctx.client, 32u));
+	assert(!dns_prefix_trie_remove(&client_ip, &ctx.client, 32u));
+	assert(dns_rpz_eval_response_ip(&rpz, &ctx.client, NULL) ==
+	       DNS_RPZ_NONE);
+	bad_net[3] = 66u;
+	dns_addr_set(&ctx.client, bad_net, 4u, 0u);
+	assert(dns_rpz_eval_response_ip(&rpz, &ctx.client, NULL) ==
+	       DNS_RPZ_LOCAL_DATA);
+
+	printf("Test Passed: response policy zones\n");
+}
+
+bool test_feed_match(struct dns_feed *feed, const char *str, uint32_t *value)
+{
+	uint8_t name[DNS_NAME_WIRE_MAX];
+	size_t len = dns_name_from_str(str, name, sizeof(name));
+
+	return dns_feed_match(feed, name, len, value);
+}
+
+void test_dns_feed(void)
+{
+	struct dns_suffix_tree base;
+	struct dns_suffix_tree overlay;
+	struct dns_suffix_tree overlay2;
+	struct dns_suffix_tree compact;
+	struct dns_suffix_node base_nodes[32];
+	struct dns_suffix_node overlay_nodes[16];
+	struct dns_suffix_node overlay2_nodes[16];
+	struct dns_suffix_node compact_nodes[32];
+	uint8_t base_labels[256];
+	uint8_t overlay_labels[128];
+	uint8_t overlay2_labels[128];
+	uint8_t compact_labels[256];
+	uint8_t name[DNS_NAME_WIRE_MAX];
+	struct dns_feed feed;
+	uint32_t value = 0u;
+	size_t len;
+	const char *diff[] = {
+		"# serial 2\n", "+tracker.net\n", "-ads.example.com\r\n",
+		"\n", "+ads.example.com.evil \n"
+	};
+	uint32_t i;
+
+	/* Base built once from a full feed */
+	dns_suffix_tree_init(&base, base_nodes, 32u, base_labels,
+			     sizeof(base_labels));
+	len = dns_name_from_str("example.com", name, sizeof(name));
+	(void)dns_suffix_tree_insert(&base, name, len, 1u);
+	len = dns_name_from_str("ads.example.com", name, sizeof(name));
+	(void)dns_suffix_tree_insert(&base, name, len, 2u);
+
+	dns_suffix_tree_init(&overlay, overlay_nodes, 16u, overlay_labels,
+			     sizeof(overlay_labels));
+	dns_feed_init(&feed, &base, &overlay);
+
+	assert(test_feed_match(&feed, "x.ads.example.com", &value));
+	assert(value == 2u);
+
+	for (i = 0u; i < (sizeof(diff) / sizeof(diff[0])); i++) {
+		assert(dns_feed_apply_line(&feed, diff[i], strlen(diff[i]),
+					   3u));
+	}
+
+	assert(!dns_feed_apply_line(&feed, "*bad", 4u, 0u));
+	assert((feed.added == 2u) && (feed.removed == 1u));
+
+	/* Blanks after the marker are skipped, blanks within name rejected */
+	assert(dns_feed_apply_line(&feed, "+ \tads.example.net", 18u, 5u));
+	assert(test_feed_match(&feed, "x.ads.example.net", &value));
+	assert(value == 5u);
+	assert(!dns_feed_apply_line(&feed, "-ads. example.net", 17u, 0u));
+	assert(!dns_feed_apply_line(&feed, "+ ", 2u, 0u));
+	assert((feed.added == 3u) && (feed.removed == 1u));
+
+	/* Removed name falls back to it's listed parent */
+	assert(test_feed_match(&feed, "x.ads.example.com", &value));
+	assert(value == 1u);
+	assert(test_feed_match(&feed, "tracker.net", &value));
+	assert(value == 3u);
+	assert(!test_feed_match(&feed, "example.org", NULL));
+
+	/* Compaction gives the same answers */
+	dns_suffix_tree_init(&compact, compact_nodes, 32u, compact_labels,
+			     sizeof(compact_labels));
+	dns_suffix_tree_init(&overlay2, overlay2_nodes, 16u, overlay2_labels,
+			     sizeof(overlay2_labels));
+	assert(dns_feed_compact_begin(&feed, &overlay2));
+	assert(!dns_feed_compact_begin(&feed, &overlay));
+
+	/* Deltas go on while the frozen overlay is merged */
+	assert(dns_feed_apply_line(&feed, "+late.example.org", 17u, 4u));
+	assert(dns_feed_apply_line(&feed, "-tracker.net", 12u, 0u));
+	assert(test_feed_match(&feed, "x.ads.example.com", &value));
+	assert(value == 1u);
+	assert(!test_feed_match(&feed, "tracker.net", NULL));
+
+	assert(dns_feed_compact(&feed, &compact));
+	dns_feed_swap(&feed, &compact);
+	assert(overlay2.len > 0u);
+
+	assert(test_feed_match(&feed, "x.ads.example.com", &value));
+	assert(value == 1u);
+	assert(test_feed_match(&feed, "www.late.example.org", &value));
+	assert(value == 4u);
+	assert(!test_feed_match(&feed, "www.tracker.net", NULL));
+	len = dns_name_from_str("tracker.net", name, sizeof(name));
+	assert(dns_suffix_tree_find(&compact, name, len) != DNS_INDEX_NONE);
+	len = dns_name_from_str("ads.example.com", name, sizeof(name));
+	assert(dns_suffix_tree_find(&compact, name, len) == DNS_INDEX_NONE);
+
+	printf("Test Passed: incremental feed\n");
+}
+
+void test_dns_list_compiler(void)
+{
+	struct dns_suffix_tree tree;
+	struct dns_suffix_tree mapped;
+	struct dns_suffix_node nodes[32];
+	struct dns_suffix_node *image_nodes;
+	uint8_t labels[256];
+	uint8_t wire[DNS_NAME_WIRE_MAX];
+	uint32_t image[512]; /* 4 byte aligned, like mmap */
+	size_t image_len;
+	size_t len;
+	size_t pos;
+	uint32_t names;
+	uint32_t node;
+	uint32_t i;
+	const char *list[] = {
+		"# hosts file",
+		"127.0.0.1 localhost",
+		"0.0.0.0 ads.example.com # ads",
+		":: tracker.net",
+		"ads.example.com # again",       /* Duplicate */
+		"metrics.example.org.",
+		"||pixel.example.net^",
+		"||cdn.example.net^$third-party", /* Has options */
+		"@@||good.example.net^",          /* Exception */
+		"! adblock comment",
+		"",
+		"0.0.0.0",                        /* Bare addresses */
+		"1.2.3.4\r\n",
+		"0.0.0.0 0.0.0.0",
+		"0.0.0.0 a.example.io localhost b.example.io:80 c.example.io\n"
+	};
+	const uint32_t expect[] = {
+		0u, 0u, 1u, 1u, 1u, 1u, 1u, 0u, 0u, 0u, 0u, 0u, 0u, 0u, 2u
+	};
+
+	dns_suffix_tree_init(&tree, nodes, 32u, labels, sizeof(labels));
+
+	for (i = 0u; i < (sizeof(list) / sizeof(list[0])); i++) {
+		pos = 0u;
+		names = 0u;
+
+		do {
+			len = dns_list_parse_line(list[i], strlen(list[i]),
+						  &pos, wire, sizeof(wire));
+
+			if (len > 0u) {
+				(void)dns_suffix_tree_insert(&tree, wire, len,
+							     i);
+				names++;
+			}
+		} while (len > 0u);
+
+		assert(names == expect[i]);
+	}
+
+	/* Aliases: "b.example.io:80" is skipped, not what follows it */
+	len = dns_name_from_str("c.example.io", wire, sizeof(wire));
+	assert(dns_suffix_tree_match(&tree, wire, len));
+
+	/* ads.example.com, example.com, com, tracker.net, net,
+	 * metrics.example.org, example.org, org, pixel.example.net,
+	 * example.net, a.example.io, c.example.io, example.io, io */
+	assert(tree.len == 14u);
+
+	image_len = dns_suffix_tree_save(&tree, (uint8_t *)image,
+					 sizeof(image));
+	assert(image_len == dns_suffix_tree_image_size(&tree));
+	assert(image_len > 0u);
+
+	assert(dns_suffix_tree_load(&mapped, (uint8_t *)image, image_len));
+	len = dns_name_from_str("x.pixel.example.net", wire, sizeof(wire));
+	assert(dns_suffix_tree_match(&mapped, wire, len));
+	len = dns_name_from_str("example.net", wire, sizeof(wire));
+	assert(!dns_suffix_tree_match(&mapped, wire, len));
+
+	/* Damaged nodes are caught by validation, not only the header */
+	image_nodes = (struct dns_suffix_node *)(void *)
+		      ((uint8_t *)image + DNS_IMAGE_HDR_LEN);
+	len = dns_name_from_str("pixel.example.net", wire, sizeof(wire));
+	node = dns_suffix_tree_longest(&mapped, wire, len, DNS_SUFFIX_TERM,
+				       NULL);
+	assert(node != DNS_INDEX_NONE);
+
+	image_nodes[node].label_ofs = 0xFFFFFF00u;
+	assert(!dns_suffix_tree_load(&mapped, (uint8_t *)image, image_len));
+	image_nodes[node].label_ofs = nodes[node].label_ofs;
+
+	image_nodes[node].next = node; /* Sibling loop */
+	assert(!dns_suffix_tree_load(&mapped, (uint8_t *)image, image_len));
+	image_nodes[node].next = nodes[node].next;
+
+	image_nodes[node].parent = node; /* Parent loop */
+	assert(!dns_suffix_tree_load(&mapped, (uint8_t *)image, image_len));
+	image_nodes[node].parent = nodes[node].parent;
+
+	assert(dns_suffix_tree_load(&mapped, (uint8_t *)image, image_len));
+
+	image[0] ^= 1u;
+	assert(!dns_suffix_tree_load(&mapped, (uint8_t *)image, image_len));
+
+	printf("Test Passed: block list compiler\n");
+}
+
+void test_dns_captive(void)
+{
+	struct dns_captive portal;
+	struct dns_msg msg;
+	uint8_t pkt[128];
+	uint8_t ip4[] = { 7, 7, 7, 7 };
+	size_t len;
+
+	dns_captive_init(&portal, ip4, NULL, 60u);
+
+	/* A: portal address */
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	len = dns_captive_answer(&portal, &msg);
+	assert(len == (sizeof(sample_query) + 16u));
+	assert((pkt[7] == 1u) && (pkt[len - 1u] == 7u));
+
+	/* AAAA without IPv6 portal address: NODATA */
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	pkt[sizeof(sample_query) - 3u] = DNS_TYPE_AAAA;
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	len = dns_captive_answer(&portal, &msg);
+	assert(len == sizeof(sample_query));
+	assert((pkt[3] & 0x0Fu) == DNS_RCODE_NOERROR);
+	assert(pkt[7] == 0u);
+
+	/* Class CH: refused, no IN address */
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	pkt[sizeof(sample_query) - 1u] = 3u;
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	len = dns_captive_answer(&portal, &msg);
+	assert(len == sizeof(sample_query));
+	assert((pkt[3] & 0x0Fu) == DNS_RCODE_REFUSED);
+	assert(pkt[7] == 0u);
+
+	/* Response (QR set): dropped, packet untouched */
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	pkt[2] = 0x81u;
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	assert(dns_captive_answer(&portal, &msg) == 0u);
+	assert((pkt[2] == 0x81u) && (pkt[3] == 0u) && (portal.dropped == 1u));
+
+	/* Opcode STATUS (2): NOTIMP with opcode echoed */
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	pkt[2] = 0x11u;
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	len = dns_captive_answer(&portal, &msg);
+	assert(len == sizeof(sample_query));
+	assert((pkt[2] == 0x91u) && ((pkt[3] & 0x0Fu) == DNS_RCODE_NOTIMP));
+	assert((pkt[7] == 0u) && (portal.notimp == 1u));
+
+	/* Answer that doesn't fit is not counted */
+	(void)memcpy(pkt, sample_query, sizeof(sample_query));
+	dns_msg_init(&msg, pkt, sizeof(sample_query));
+	dns_msg_parse_query(&msg, sizeof(sample_query));
+	assert(dns_captive_answer(&portal, &msg) == 0u);
+
+	assert((portal.answered == 1u) && (portal.nodata == 1u));
+	assert(portal.refused == 1u);
+
+	printf("Test Passed: captive portal responder\n");
+}
+
+void test_dns_mdns(void)
+{
+	/* printer.local A (QU bit set) and AAAA (compressed name), one known
+	 * answer 192.168.1.5 with TTL 60 */
+	uint8_t query[] = {
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x01,
+		0x00, 0x00, 0x00, 0x00,
+		0x07, 'p', 'r', 'i', 'n', 't', 'e', 'r',
+		0x05, 'l', 'o', 'c', 'a', 'l', 0x00,
+		0x00, 0x01, 0x80, 0x01,
+		0xC0, 0x0C, 0x00, 0x1C, 0x00, 0x01,
+		0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3C,
+		0x00, 0x04, 192, 168, 1, 5
+	};
+	static uint8_t big_buf[0x4100];
+	uint8_t ip_known[] = { 192, 168, 1, 5 };
+	uint8_t ip_other[] = { 192, 168, 1, 6 };
+	uint8_t rr[32];
+	uint8_t pkt[128];
+	uint8_t batch_buf[64];
+	uint8_t wire[DNS_QNAME_WIRE_MAX];
+	uint8_t other[DNS_QNAME_WIRE_MAX];
+	struct dns_mdns_batch batch;
+	struct dns_msg_ctx ctx;
+	struct dns_msg msg;
+	uint16_t type = 0u;
+	uint16_t qclass = 0u;
+	size_t wire_len;
+	size_t other_len;
+	size_t len;
+
+	wire_len  = dns_name_from_str("printer.local", wire, sizeof(wire));
+	other_len = dns_name_from_str("scanner.local", other, sizeof(other));
+
+	(void)memcpy(pkt, query, sizeof(query));
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(query));
+	assert(msg.malformed == 0u);
+	assert(dns_msg_mdns_unicast(&msg));
+	assert(dns_msg_mdns_class(&msg) == DNS_CLASS_IN);
+
+	/* Second question: compressed name is expanded */
+	assert(dns_msg_question_count(&msg) == 2u);
+	len = dns_msg_question(&msg, 1u, rr, sizeof(rr), &type, &qclass);
+	assert(dns_name_eq(rr, len, wire, wire_len));
+	assert((type == DNS_TYPE_AAAA) && (qclass == DNS_CLASS_IN));
+	len = dns_msg_question(&msg, 0u, rr, sizeof(rr), &type, &qclass);
+	assert((len == wire_len) && (type == DNS_TYPE_A));
+	assert(qclass == (DNS_MDNS_CLASS_BIT | DNS_CLASS_IN));
+	assert(dns_msg_question(&msg, 2u, rr, sizeof(rr), &type,
+				&qclass) == 0u);
+
+	/* Known with TTL 60 after both questions: suppressed for TTL 120,
+	 * not for TTL 121, other data, other type or other owner */
+	assert(dns_msg_mdns_known_answer(&msg, wire, wire_len, DNS_TYPE_A,
+					 ip_known, 4u, 120u));
+	assert(!dns_msg_mdns_known_answer(&msg, wire, wire_len, DNS_TYPE_A,
+					  ip_known, 4u, 121u));
+	assert(!dns_msg_mdns_known_answer(&msg, wire, wire_len, DNS_TYPE_A,
+					  ip_other, 4u, 120u));
+	assert(!dns_msg_mdns_known_answer(&msg, wire, wire_len,
+					  DNS_TYPE_AAAA, ip_known, 4u, 120u));
+	assert(!dns_msg_mdns_known_answer(&msg, other, other_len,
+					  DNS_TYPE_A, ip_known, 4u, 120u));
+
+	/* Pointer loop is rejected */
+	pkt[38] = 37u;
+	assert(!dns_msg_mdns_known_answer(&msg, wire, wire_len, DNS_TYPE_A,
+					  ip_known, 4u, 120u));
+	pkt[38] = 12u;
+
+	/* QU reply from port 5353: ID 0, no question, QNAME owns answer */
+	dns_msg_ctx_init(&ctx, DNS_TRANSPORT_UDP, 0u, 0u);
+	dns_addr_set(&ctx.client, ip_known, 4u, DNS_PORT_MDNS);
+	assert(!dns_mdns_legacy(&ctx));
+
+	(void)memcpy(pkt, query, sizeof(query));
+	pkt[0] = 0x12u;
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(query));
+	len = dns_rr_build(rr, sizeof(rr), DNS_TYPE_A, 120u, ip_other, 4u);
+	len = dns_msg_add_answer(&msg, rr, len);
+	assert(len == (31u + 16u));
+	len = dns_msg_mdns_finish(&msg, len, &ctx);
+	assert(len == (12u + 15u + 10u + 4u));
+	assert((pkt[0] == 0u) && (pkt[1] == 0u));
+	assert((pkt[2] == 0x84u) && (pkt[3] == 0u));
+	assert((pkt[5] == 0u) && (pkt[7] == 1u));
+	assert(memcmp(&pkt[12], wire, wire_len) == 0);
+	assert((pkt[28] == DNS_TYPE_A) && (pkt[34] == 120u));
+	assert(pkt[len - 1u] == 6u);
+
+	/* Legacy unicast: ID and question echoed, TTL cut to 10 s */
+	dns_addr_set(&ctx.client, ip_known, 4u, 40000u);
+	assert(dns_mdns_legacy(&ctx));
+
+	(void)memcpy(pkt, query, sizeof(query));
+	pkt[0] = 0x12u;
+	dns_msg_init(&msg, pkt, sizeof(pkt));
+	dns_msg_parse_query(&msg, sizeof(query));
+	len = dns_rr_build(rr, sizeof(rr), DNS_TYPE_A, 120u, ip_other, 4u);
+	rr[4] = 0x80u; /* Cache-flush */
+	len = dns_msg_add_answer(&msg, rr, len);
+	len = dns_msg_mdns_finish(&msg, len, &ctx);
+	assert(len == (31u + 16u));
+	assert((pkt[0] == 0x12u) && (pkt[2] == 0x84u));
+	assert((pkt[5] == 1u) && (pkt[7] == 1u));
+	assert((pkt[35] == 0u) && (pkt[36] == 1u));
+	assert((pkt[39] == 0u) && (pkt[40] == 10u));
+
+	/* LLMNR answer */
+	dns_msg_llmnr_finish(&msg);
+	assert((pkt[2] == 0x80u) && (pkt[3] == 0u));
+
+	/* Batch capacity is limited to compression pointer range */
+	dns_mdns_batch_init(&batch, big_buf, sizeof(big_buf), 20u);
+	assert(batch._cap == DNS_MDNS_BATCH_CAP_MAX);
+
+	/* Multicast batch: duplicates dropped, owner name compressed */
+	dns_mdns_batch_init(&batch, batch_buf, sizeof(batch_buf), 20u);
+	assert(dns_mdns_batch_add(&batch, wire, wire_len, DNS_TYPE_A, true,
+				  120u, ip_known, 4u));
+	assert(dns_mdns_batch_add(&batch, wire, wire_len, DNS_TYPE_A, true,
+				  120u, ip_known, 4u));
+	assert((batch.records == 1u) && (batch.duplicates == 1u));
+	assert(batch.len == (12u + 15u + 10u + 4u));
+	assert((batch_buf[2] == 0x84u) && (batch_buf[7] == 1u));
+	assert((batch_buf[12u + 15u + 2u] == 0x80u) &&
+	       (batch_buf[12u + 15u + 3u] == 0x01u));
+
+	assert(dns_mdns_batch_add(&batch, wire, wire_len, DNS_TYPE_A, false,
+				  120u, ip_other, 4u));
+	assert(batch.len == (12u + 15u + 10u + 4u + 2u + 10u + 4u));
+	assert((batch_buf[41] == 0xC0u) && (batch_buf[42] == 12u));
+	assert(batch_buf[46] == 0x01u);
+
+	/* Full: flush, then add again */
+	assert(!dns_mdns_batch_add(&batch, wire, wire_len, DNS_TYPE_AAAA,
+				   true, 120u, NULL, 16u));
+
+	assert(!dns_mdns_batch_tick(&batch, 10u));
+	assert(dns_mdns_batch_tick(&batch, 10u));
+	assert(dns_mdns_batch_flush(&batch) == 57u);
+	assert(dns_mdns_batch_flush(&batch) == 0u);
+	assert(!dns_mdns_batch_tick(&batch, 100u));
+
+	printf("Test Passed: mDNS and LLMNR\n");
+}
+
 int main(void) {
 	test_dns_parsing_standard();
+	test_dns_edns_answer();
+	test_dns_stream_pipelining();
+	test_dns_dot();
+	test_dns_doh();
+	test_dns_b64url();
+	test_dns_proxy_v2();
+	test_dns_latency();
+	test_dns_admission();
+	test_dns_cpu_map();
+	test_dns_worker_steering();
+	test_dns_hot_table();
+	test_dns_busy_poll();
+	test_dns_0x20();
+	test_dns_name_primitives();
+	test_dns_name_index();
+	test_dns_suffix_tree();
+	test_dns_zone_lookup();
+	test_dns_zone_index();
+	test_dns_any();
+	test_dns_amp_guard();
+	test_dns_acl();
+	test_dns_rpz();
+	test_dns_feed();
+	test_dns_list_compiler();
+	test_dns_captive();
+	test_dns_mdns();
 
 	return 0;
 }
@@ -0,0 +1,207 @@
+/**
+ * @file dns_tools.xdp.bpf.c
+ * @brief XDP fast path answering hot static records in the driver hook
+ *
+ * Answers standard class IN queries (IPv4, UDP port 53, single question)
+ * whose QNAME and QTYPE are in the `dns_hot` map straight from the driver
+ * hook. Like `dns_hot_answer`, the precompiled answer RR replaces anything
+ * after the question and the frame is bounced back (XDP_TX). Everything
+ * else is passed to the userspace server (XDP_PASS). The map is filled
+ * from a `struct dns_hot_table` by the loader (dns_tools.xdp.c).
+ *
+ * IPv6 is passed to userspace: its UDP checksum is mandatory and
+ * recomputing it over the payload in the hook isn't worth it.
+ *
+ * Build: `make bpf` (clang -O2 -g -target bpf)
+ */
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+
+#include "dns_tools.bpf.h"
+
+/** Length of Ethernet, IPv4 (no options), UDP and DNS headers */
+#define DNS_XDP_HDR_LEN (sizeof(struct ethhdr) + sizeof(struct iphdr) + \
+			 sizeof(struct udphdr) + 12u)
+
+/** Hot records, key is QNAME hash and type */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, DNS_BPF_HOT_MAX);
+	__type(key, struct dns_bpf_hot_key);
+	__type(value, struct dns_bpf_hot_entry);
+} dns_hot SEC(".maps");
+
+/** Counters (DNS_BPF_STAT_*) */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, DNS_BPF_STATS);
+	__type(key, __u32);
+	__type(value, __u64);
+} dns_hot_stats SEC(".maps");
+
+/** Increments counter, returns XDP action */
+static __always_inline int dns_xdp_count(__u32 stat, int action)
+{
+	__u64 *n = bpf_map_lookup_elem(&dns_hot_stats, &stat);
+
+	if (n != NULL) {
+		*n += 1u;
+	}
+
+	return action;
+}
+
+/** Returns checksum of 20 byte IPv4 header (check field zeroed first) */
+static __always_inline __u16 dns_xdp_ip_csum(struct iphdr *ip)
+{
+	__u16 *w = (__u16 *)ip;
+	__u32 sum = 0u;
+	__u32 i;
+
+	ip->check = 0u;
+
+	for (i = 0u; i < (sizeof(*ip) / 2u); i++) {
+		sum += w[i];
+	}
+
+	sum = (sum & 0xFFFFu) + (sum >> 16);
+	sum = (sum & 0xFFFFu) + (sum >> 16);
+
+	return (__u16)~sum;
+}
+
+/** Returns true if hot entry name equals lower cased QNAME */
+static __always_inline int dns_xdp_name_eq(const struct dns_bpf_hot_entry *e,
+					   const __u8 *name, __u32 len)
+{
+	int eq = (e->name_len == len);
+	__u32 i;
+
+	for (i = 0u; eq && (i < DNS_BPF_NAME_MAX); i++) {
+		eq = (i >= len) || (e->name[i] == name[i]);
+	}
+
+	return eq;
+}
+
+SEC("xdp")
+int dns_xdp_hot(struct xdp_md *ctx)
+{
+	void *data     = (void *)(long)ctx->data;
+	void *data_end = (void *)(long)ctx->data_end;
+	struct ethhdr *eth = data;
+	struct iphdr  *ip  = (void *)(eth + 1);
+	struct udphdr *udp = (void *)(ip + 1);
+	__u8 *dns = (void *)(udp + 1);
+	__u8 *q;
+	__u8  name[DNS_BPF_NAME_MAX];
+	__u8  mac[ETH_ALEN];
+	struct dns_bpf_hot_key key = { 0 };
+	struct dns_bpf_hot_entry *e;
+	__u32 qlen;
+	__u32 rr_len;
+	__u32 addr;
+	__u16 port;
+	__u32 i;
+
+	if (((void *)(dns + 12) > data_end) ||
+	    (eth->h_proto != bpf_htons(ETH_P_IP)) || (ip->ihl != 5u) ||
+	    (ip->protocol != IPPROTO_UDP) ||
+	    ((ip->frag_off & bpf_htons(0x3FFFu)) != 0u) ||
+	    (udp->dest != bpf_htons(DNS_BPF_PORT))) {
+		return XDP_PASS; /* Not a DNS query, don't count */
+	}
+
+	/* Standard query (QR 0, opcode 0), single question, no answers */
+	if (((dns[2] & 0xF8u) != 0u) || (dns[4] != 0u) || (dns[5] != 1u) ||
+	    (dns[6] != 0u) || (dns[7] != 0u)) {
+		return dns_xdp_count(DNS_BPF_STAT_PASSED, XDP_PASS);
+	}
+
+	qlen = dns_bpf_qname(dns + 12, data_end, name, &key.hash);
+	qlen &= 0x7Fu; /* Bound for the verifier (at most 65) */
+	q = dns + 12 + qlen;
+
+	if ((qlen == 0u) || ((void *)(q + 4) > data_end) ||
+	    (q[2] != 0u) || (q[3] != 1u)) {
+		return dns_xdp_count(DNS_BPF_STAT_PASSED, XDP_PASS);
+	}
+
+	key.type = (__u16)((q[0] << 8) | q[1]);
+
+	e = bpf_map_lookup_elem(&dns_hot, &key);
+	if ((e == NULL) || (e->rr_len > DNS_BPF_RR_MAX) ||
+	    !dns_xdp_name_eq(e, name, qlen)) {
+		return dns_xdp_count(DNS_BPF_STAT_PASSED, XDP_PASS);
+	}
+
+	/* Answer replaces anything after the question (EDNS OPT included) */
+	rr_len = e->rr_len;
+	if (bpf_xdp_adjust_tail(ctx, (int)(DNS_XDP_HDR_LEN + qlen + 4u +
+					   rr_len) -
+				     (int)(data_end - data)) != 0) {
+		return dns_xdp_count(DNS_BPF_STAT_PASSED, XDP_PASS);
+	}
+
+	data     = (void *)(long)ctx->data;
+	data_end = (void *)(long)ctx->data_end;
+	eth = data;
+	ip  = (void *)(eth + 1);
+	udp = (void *)(ip + 1);
+	dns = (void *)(udp + 1);
+
+	if ((void *)(dns + 12) > data_end) {
+		return XDP_ABORTED;
+	}
+
+	for (i = 0u; i < DNS_BPF_RR_MAX; i++) {
+		__u8 *p = dns + 12 + qlen + 4u + i;
+
+		if (i >= rr_len) {
+			/* Past the answer */
+		} else if ((void *)(p + 1) > data_end) {
+			return XDP_ABORTED;
+		} else {
+			*p = e->rr[i];
+		}
+	}
+
+	/* Same header as `dns_msg_add_answer` */
+	dns[2]  = 0x81u;
+	dns[3]  = 0x80u;
+	dns[6]  = 0u;
+	dns[7]  = 1u;
+	dns[8]  = 0u;
+	dns[9]  = 0u;
+	dns[10] = 0u;
+	dns[11] = 0u;
+
+	/* Bounce back to the client */
+	__builtin_memcpy(mac, eth->h_source, ETH_ALEN);
+	__builtin_memcpy(eth->h_source, eth->h_dest, ETH_ALEN);
+	__builtin_memcpy(eth->h_dest, mac, ETH_ALEN);
+
+	addr = ip->saddr;
+	ip->saddr = ip->daddr;
+	ip->daddr = addr;
+	ip->ttl = 64u;
+	ip->tot_len = bpf_htons((__u16)(sizeof(*ip) + sizeof(*udp) + 12u +
+					qlen + 4u + rr_len));
+	ip->check = dns_xdp_ip_csum(ip);
+
+	port = udp->source;
+	udp->source = udp->dest;
+	udp->dest = port;
+	udp->len = bpf_htons((__u16)(sizeof(*udp) + 12u + qlen + 4u + rr_len));
+	udp->check = 0u; /* Optional for IPv4 */
+
+	return dns_xdp_count(DNS_BPF_STAT_ANSWERED, XDP_TX);
+}
+
+char _license[] SEC("license") = "Dual BSD/GPL";
@@ -0,0 +1,229 @@
+/**
+ * @file dns_tools.xdp.c
+ * @brief Loader of the XDP hot record fast path (binding layer)
+ *
+ * Builds a `struct dns_hot_table` from the command line (the very table
+ * the userspace server answers from), copies its entries as is into the
+ * map of dns_tools.xdp.bpf.c, attaches the program to an interface and
+ * keeps it attached until interrupted. Needs libbpf 1.0 or newer.
+ * Build: `make bpf`. Try it on a veth pair in a network namespace:
+ *
+ * ```
+ * ip netns add dns
+ * ip link add veth0 type veth peer name veth1 netns dns
+ * ip addr add 10.0.0.1/24 dev veth0
+ * ip link set veth0 up
+ * ethtool -K veth0 gro on  # veth0 must accept XDP_TX frames (NAPI)
+ * ip -n dns addr add 10.0.0.2/24 dev veth1
+ * ip -n dns link set veth1 up
+ * ip netns exec dns ./dns_xdp veth1 dns_xdp.bpf.o \
+ *     www.example.com A 192.0.2.1 300
+ * dig @10.0.0.2 www.example.com A
+ * ```
+ *
+ * Queries for other names get no answer in this setup, as there is no
+ * userspace server behind the hook.
+ */
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_link.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "dns_tools.h"
+#include "dns_tools.bpf.h"
+
+/* Map values are hot table entries copied as is */
+typedef char dns_xdp_layout_check[
+	((sizeof(struct dns_bpf_hot_entry) == sizeof(struct dns_hot_entry)) &&
+	 (offsetof(struct dns_bpf_hot_entry, rr) ==
+	  offsetof(struct dns_hot_entry, rr)) &&
+	 (DNS_BPF_NAME_MAX == DNS_QNAME_WIRE_MAX) &&
+	 (DNS_BPF_RR_MAX == DNS_HOT_RR_MAX) &&
+	 (DNS_BPF_HASH_BASIS == DNS_HASH_BASIS) &&
+	 (DNS_BPF_HASH_PRIME == DNS_HASH_PRIME) &&
+	 (DNS_BPF_PORT == DNS_PORT)) ? 1 : -1];
+
+static struct dns_hot_entry dns_xdp_entries[DNS_BPF_HOT_MAX];
+static struct dns_hot_table dns_xdp_hot;
+
+static volatile sig_atomic_t dns_xdp_stop;
+
+static void dns_xdp_on_signal(int sig)
+{
+	(void)sig;
+	dns_xdp_stop = 1;
+}
+
+/** Copies hot table entries into XDP map. Entries with colliding hash and
+ *  type overwrite each other, the hook then passes the loser to userspace.
+ *  Returns number of records copied, -1 on error */
+static int dns_xdp_sync(int map_fd, const struct dns_hot_table *hot)
+{
+	struct dns_bpf_hot_key key;
+	int result = 0;
+	uint32_t i;
+
+	for (i = 0u; (result >= 0) && (i < hot->_cap); i++) {
+		const struct dns_hot_entry *e = &hot->_entries[i];
+
+		if (e->name_len > 0u) {
+			key.hash      = e->hash;
+			key.type      = e->type;
+			key._reserved = 0u;
+
+			if (bpf_map_update_elem(map_fd, &key, e, BPF_ANY) != 0) {
+				result = -1;
+			} else {
+				result++;
+			}
+		}
+	}
+
+	return result;
+}
+
+/** Adds record given as `name` `A|AAAA` `address` `ttl_s` */
+static bool dns_xdp_add(char **arg)
+{
+	uint8_t  wire[DNS_QNAME_WIRE_MAX];
+	uint8_t  rdata[16];
+	size_t   wire_len = dns_name_from_str(arg[0], wire, sizeof(wire));
+	uint32_t ttl_s = (uint32_t)strtoul(arg[3], NULL, 10);
+	bool     result = false;
+
+	if (wire_len == 0u) {
+		/* Invalid name */
+	} else if ((strcmp(arg[1], "A") == 0) &&
+		   (inet_pton(AF_INET, arg[2], rdata) == 1)) {
+		result = dns_hot_add(&dns_xdp_hot, wire, wire_len, DNS_TYPE_A,
+				     ttl_s, rdata, 4u);
+	} else if ((strcmp(arg[1], "AAAA") == 0) &&
+		   (inet_pton(AF_INET6, arg[2], rdata) == 1)) {
+		result = dns_hot_add(&dns_xdp_hot, wire, wire_len,
+				     DNS_TYPE_AAAA, ttl_s, rdata, 16u);
+	} else {}
+
+	return result;
+}
+
+/** Sums per CPU counter */
+static unsigned long long dns_xdp_stat(int map_fd, uint32_t stat)
+{
+	int ncpu = libbpf_num_possible_cpus();
+	unsigned long long sum = 0u;
+	unsigned long long *values;
+	int i;
+
+	values = (ncpu > 0) ? calloc((size_t)ncpu, sizeof(*values)) : NULL;
+
+	if ((values != NULL) &&
+	    (bpf_map_lookup_elem(map_fd, &stat, values) == 0)) {
+		for (i = 0; i < ncpu; i++) {
+			sum += values[i];
+		}
+	}
+
+	free(values);
+
+	return sum;
+}
+
+int main(int argc, char **argv)
+{
+	struct bpf_object  *obj = NULL;
+	struct bpf_program *prog = NULL;
+	unsigned int ifindex = 0u;
+	int hot_map = -1;
+	int stats_map = -1;
+	int prog_fd = -1;
+	int records = -1;
+	int i;
+	bool attached = false;
+	bool args_ok = (argc >= 3) && (((argc - 3) % 4) == 0);
+	bool ok = args_ok;
+
+	if (!ok) {
+		fprintf(stderr, "usage: %s <ifname> <bpf object> "
+				"[<name> <A|AAAA> <address> <ttl_s>]...\n",
+			argv[0]);
+	}
+
+	dns_hot_init(&dns_xdp_hot, dns_xdp_entries, DNS_BPF_HOT_MAX);
+
+	for (i = 3; ok && (i < argc); i += 4) {
+		ok = dns_xdp_add(&argv[i]);
+
+		if (!ok) {
+			fprintf(stderr, "bad record: %s %s %s %s\n", argv[i],
+				argv[i + 1], argv[i + 2], argv[i + 3]);
+		}
+	}
+
+	args_ok = ok;
+
+	if (ok) {
+		ifindex = if_nametoindex(argv[1]);
+		obj = bpf_object__open_file(argv[2], NULL);
+		ok  = (ifindex > 0u) && (obj != NULL) &&
+		      (bpf_object__load(obj) == 0);
+	}
+
+	if (ok) {
+		prog      = bpf_object__find_program_by_name(obj, "dns_xdp_hot");
+		hot_map   = bpf_object__find_map_fd_by_name(obj, "dns_hot");
+		stats_map = bpf_object__find_map_fd_by_name(obj,
+							    "dns_hot_stats");
+		prog_fd   = (prog != NULL) ? bpf_program__fd(prog) : -1;
+
+		ok = (prog_fd >= 0) && (hot_map >= 0) && (stats_map >= 0);
+	}
+
+	if (ok) {
+		records = dns_xdp_sync(hot_map, &dns_xdp_hot);
+		ok = (records >= 0);
+	}
+
+	/* Driver mode where supported, generic mode otherwise */
+	if (ok) {
+		attached = (bpf_xdp_attach((int)ifindex, prog_fd,
+					   XDP_FLAGS_UPDATE_IF_NOEXIST,
+					   NULL) == 0);
+		ok = attached;
+	}
+
+	if (ok) {
+		printf("%d hot records answered on %s, ^C to detach\n",
+		       records, argv[1]);
+
+		(void)signal(SIGINT, dns_xdp_on_signal);
+		(void)signal(SIGTERM, dns_xdp_on_signal);
+
+		while (dns_xdp_stop == 0) {
+			(void)sleep(1u);
+		}
+
+		printf("answered %llu, passed %llu\n",
+		       dns_xdp_stat(stats_map, DNS_BPF_STAT_ANSWERED),
+		       dns_xdp_stat(stats_map, DNS_BPF_STAT_PASSED));
+	} else if (args_ok) {
+		fprintf(stderr, "failed to load %s onto %s\n", argv[2],
+			argv[1]);
+	} else {}
+
+	if (attached) {
+		(void)bpf_xdp_detach((int)ifindex, 0u, NULL);
+	}
+
+	if (obj != NULL) {
+		bpf_object__close(obj);
+	}
+
+	return ok ? 0 : 1;
+}